@@ -10,638 +10,5844 @@
 #include <openssl/sha.h>
 #include <openssl/evp.h>
 #include <queue>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <unistd.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <string_view>
+#include <utility>
+#include <memory>
+#include <list>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <zlib.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
+#endif
+#ifdef MINIGIT_ZSTD
+#include <zstd.h>
+#endif
+#ifdef MINIGIT_BLAKE3
+#include <blake3.h>
+#endif
 
 
 using namespace std;
 using namespace filesystem;
 
-struct CommitNode {
-    string id;
-    string stageSnap;
-    string prevCommit;
-    string timestamp;
-    string author;
-    string comment;
-};
+/**
+ * Tracer - process-wide timing spans and counters
+ *
+ * Off unless a trace file or stats were requested at startup, in which case
+ * a span costs a branch and nothing else. Events are buffered per thread and
+ * gathered when a worker thread exits or the report is written.
+ */
+class Tracer {
+public:
+    enum Counter { bytesHashed, bytesCopied, filesOpened, objectsWritten, counterCount };
+    struct Event {
+        const char* name;
+        uint64_t start, duration;
+    };
+
+    static inline bool enabled = false, stats = false;
+    static inline string tracePath;
+
+    static uint64_t now() {
+        return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    static void add(Counter counter, uint64_t amount) {
+        if (enabled) counters[counter].fetch_add(amount, memory_order_relaxed);
+    }
+    static void record(const char* name, uint64_t start) {
+        Buffer& buffer = local();
+        buffer.events.push_back({ name, start, now() - start });
+    }
+    static void finish();
+/**
+ * intern - gives a runtime string a lifetime long enough to name a span
+ * @name: the span name
+ * Return: a pointer that stays valid until exit
+ */
+    static const char* intern(const string& name) {
+        lock_guard<mutex> guard(lock);
+        return names.insert(name).first->c_str();
+    }
 
-class MinGit {
 private:
-    path repoPath;
-    string repoName;
-    string author;
+    struct Buffer {
+        uint32_t thread;
+        vector<Event> events;
+        ~Buffer() { gather(*this); }
+    };
+
+    static inline atomic<uint64_t> counters[counterCount];
+    static inline mutex lock;
+    static inline vector<pair<uint32_t, Event>> all;
+    static inline unordered_set<string> names;
+    static inline atomic<uint32_t> threads{0};
+    static inline uint64_t origin = now();
 
+    static Buffer& local() {
+        thread_local Buffer buffer{ threads++, {} };
+        return buffer;
+    }
+    static void gather(Buffer& buffer) {
+        lock_guard<mutex> guard(lock);
+        for (const Event& event : buffer.events)
+            all.push_back({ buffer.thread, event });
+        buffer.events.clear();
+    }
+};
 
 /**
- * recordAuthor - registers the author and associates it with a branch name
- * @branch: the name of the branch
- * @author: the author name to be recorded
+ * jsonString - quotes text as a JSON string
+ * @text: the text, e.g. a span name built from a path
+ * Return: the text in double quotes with quotes, backslashes and control characters escaped
  */
-    void recordAuthor(const string& branch, const string& author) {
-        path authorPath = repoPath / "authors" / branch;
-        ofstream out(authorPath);
-        out << author;
-        out.close();
+string jsonString(const char* text) {
+    string quoted = "\"";
+    for (; *text; ++text) {
+        uint8_t c = *text;
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+            quoted += char(c);
+        } else if (c < 0x20) {
+            char escape[8];
+            snprintf(escape, sizeof(escape), "\\u%04x", c);
+            quoted += escape;
+        } else {
+            quoted += char(c);
+        }
     }
+    return quoted + '"';
+}
+
 /**
- * stageOf - transforms a stage from a stage file path into a map
- * @stagePath: path to the stage snapshot file
- * Return: map of staged files and their hashes
+ * finish - writes the Chrome trace and prints the per-phase summary
+ *
+ * The trace is the JSON trace-event format read by chrome://tracing and
+ * Perfetto: one complete ("X") event per span and the counters at the end.
  */
-    unordered_map<string, string> stageOf(const path& stagePath) {
-        unordered_map<string, string> stage;
-        ifstream sStream(stagePath);
-        string line;
-        while (getline(sStream, line)) {
-            istringstream lStream(line);
-            string file, hash;
-            if (lStream >> file >> hash)
-                stage[file] = hash;
+void Tracer::finish() {
+    if (!enabled) return;
+    gather(local());
+    static const char* counterNames[] = { "bytes hashed", "bytes copied", "files opened", "objects written" };
+
+    if (!tracePath.empty()) {
+        ofstream out(tracePath);
+        out << fixed << setprecision(3) << "{\"traceEvents\":[";
+        bool first = true;
+        uint64_t last = origin;
+        for (const auto& [thread, event] : all) {
+            out << (first ? "\n" : ",\n") << "{\"name\":" << jsonString(event.name) << ",\"ph\":\"X\",\"pid\":" << getpid()
+                << ",\"tid\":" << thread << ",\"ts\":" << (event.start - origin) / 1e3
+                << ",\"dur\":" << event.duration / 1e3 << "}";
+            last = max(last, event.start + event.duration);
+            first = false;
         }
-        return stage;
+        for (int c = 0; c < counterCount; ++c)
+            out << (first ? "\n" : ",\n") << "{\"name\":\"" << counterNames[c] << "\",\"ph\":\"C\",\"pid\":" << getpid()
+                << ",\"tid\":0,\"ts\":" << (last - origin) / 1e3 << ",\"args\":{\"value\":" << counters[c] << "}}",
+            first = false;
+        out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+        if (!out) cerr << "Unable to write the trace to " << tracePath << "\n";
     }
+
+    if (stats) {
+        map<string, pair<uint64_t, uint64_t>> phases;
+        for (const auto& [thread, event] : all) {
+            auto& phase = phases[event.name];
+            ++phase.first;
+            phase.second += event.duration;
+        }
+        cerr << left << setw(16) << "phase" << right << setw(10) << "calls" << setw(14) << "total ms" << "\n";
+        for (const auto& [name, phase] : phases)
+            cerr << left << setw(16) << name << right << setw(10) << phase.first
+                 << setw(14) << fixed << setprecision(3) << phase.second / 1e6 << "\n";
+        for (int c = 0; c < counterCount; ++c)
+            cerr << left << setw(16) << counterNames[c] << right << setw(24) << counters[c] << "\n";
+        cerr << left;
+    }
+}
+
 /**
- * blob - Stores a file by the hash as a name in the object directory if it is not already stored
- * @filePath: path to the file to be stored
- * Return: hash filename for the blob
+ * TraceSpan - times the enclosing scope as a trace event
+ * @name: phase name, a string literal
  */
-    string blob(const path& filePath) {
-        path fullPath = repoPath.parent_path() / filePath;
-        string blobFile = hashOf(fullPath);
-        if (blobFile.empty()) return "";
-    
-        path blobPath = repoPath / "objects" / blobFile;
-        if (!exists(blobPath))
-            copy_file(fullPath, blobPath, copy_options::overwrite_existing);
-        return blobFile;
+class TraceSpan {
+    const char* name;
+    uint64_t start;
+
+public:
+    explicit TraceSpan(const char* name) : name(name), start(Tracer::enabled ? Tracer::now() : 0) {}
+    ~TraceSpan() {
+        if (Tracer::enabled) Tracer::record(name, start);
     }
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+};
+
 /**
- * activeBranch - takes the current active branch from HEAD file
- * Return: name of the current branch
+ * parallelFor - runs a task for every index in [0, count) on a worker pool sized to the cores
+ * @count: number of work items
+ * @task: callable invoked once per item index
  */
-    string activeBranch() {
-        ifstream head(repoPath / "HEAD");
-        string branch;
-        getline(head, branch);
-        return branch;
-    }
+void parallelFor(size_t count, const function<void(size_t)>& task) {
+    size_t workers = min<size_t>(count, max(1u, thread::hardware_concurrency()));
+    atomic<size_t> next{0};
+    auto worker = [&]() {
+        for (size_t i = next++; i < count; i = next++)
+            task(i);
+    };
+
+    vector<thread> pool;
+    for (size_t w = 1; w < workers; ++w)
+        pool.emplace_back(worker);
+    worker();
+    for (auto& t : pool)
+        t.join();
+}
+
 /**
- * hashOf - Generates SHA hash when provided a file path
- * @filePath: path to the file
- * Return: SHA hash of the file's contents
+ * hexOf - encodes raw digest bytes as a lowercase hex string
+ * @hash: digest bytes
+ * @len: number of digest bytes
+ * Return: hex string
  */
-    string hashOf(const path& filePath) {
-        ifstream file(filePath, ios::binary);
-        if (!file) return "";
-        stringstream buffer;
-        buffer << file.rdbuf();
-        return hashOf(buffer.str());
+string hexOf(const unsigned char* hash, size_t len) {
+    static const char digits[] = "0123456789abcdef";
+    string out(len * 2, '0');
+    for (size_t i = 0; i < len; ++i) {
+        out[2 * i] = digits[hash[i] >> 4];
+        out[2 * i + 1] = digits[hash[i] & 15];
     }
+    return out;
+}
+
+string hexOf(string_view raw) {
+    return hexOf(reinterpret_cast<const unsigned char*>(raw.data()), raw.size());
+}
+
 /**
- * hashOf - Generates SHA hash from a string provided
- * @content: input string
- * Return: SHA hash 
+ * parseNumber - parses a whole string as an unsigned decimal number
+ * @text: the string
+ * @value: set to the number on success
+ * Return: false if @text is empty, has anything but digits or overflows
  */
-    string hashOf(const string& content) {
-        EVP_MD_CTX* ctx = EVP_MD_CTX_new();
-        EVP_DigestInit_ex(ctx, EVP_sha1(), nullptr);
-        EVP_DigestUpdate(ctx, content.c_str(), content.size());
-    
-        unsigned char hash[EVP_MAX_MD_SIZE];
-        unsigned int len;
-        EVP_DigestFinal_ex(ctx, hash, &len);
-        EVP_MD_CTX_free(ctx);
-    
-        stringstream ss;
-        for (unsigned int i = 0; i < len; ++i)
-            ss << hex << setw(2) << setfill('0') << static_cast<int>(hash[i]);
-        return ss.str();
-    }
+bool parseNumber(const string& text, uint64_t& value) {
+    if (text.empty() || !isdigit(uint8_t(text[0]))) return false;
+    errno = 0;
+    char* end = nullptr;
+    unsigned long long parsed = strtoull(text.c_str(), &end, 10);
+    if (errno == ERANGE || *end != '\0') return false;
+    value = parsed;
+    return true;
+}
 
 /**
- * latestCommit - fetches the latest commit ID from the currently active branch
- * Return: latest commit ID 
+ * rawOf - decodes a hex string into raw digest bytes
+ * @hex: hex string
+ * Return: raw bytes, or an empty string if @hex is not valid hex
  */
-    string latestCommit() {
-        ifstream h(repoPath / "HEAD");
-        string ref;
-        getline(h, ref);
-        h.close();
-        return latestCommit(ref);
+string rawOf(string_view hex) {
+    auto nibble = [](char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    };
+    if (hex.size() % 2) return "";
+    string raw(hex.size() / 2, '\0');
+    for (size_t i = 0; i < raw.size(); ++i) {
+        int hi = nibble(hex[2 * i]), lo = nibble(hex[2 * i + 1]);
+        if (hi < 0 || lo < 0) return "";
+        raw[i] = char(hi << 4 | lo);
     }
+    return raw;
+}
+
+static constexpr size_t checksumSize = 20;
+
 /**
- * latestCommit - fetchs latest commit ID of a given branch
- * @branch: the branch name
- * Return: latest commit ID for the branch
+ * checksumOf - computes the raw SHA-1 used as the trailer of binary files
+ * @data: bytes to checksum
+ * @len: number of bytes
+ * Return: 20 raw digest bytes
  */
-    string latestCommit(const string& branch) {
-        path refPath = repoPath / "refs" / branch;
-        if (!exists(refPath)) return "";
-        ifstream in(refPath);
-        string id;
-        getline(in, id);
-        in.close();
-        return id;
+string checksumOf(const char* data, size_t len) {
+    unsigned char hash[EVP_MAX_MD_SIZE];
+    unsigned int hashLen;
+    EVP_Digest(data, len, hash, &hashLen, EVP_sha1(), nullptr);
+    return string(reinterpret_cast<char*>(hash), hashLen);
+}
+
+/**
+ * HashAlgorithm - the digest that names a repository's objects
+ */
+enum class HashAlgorithm : uint8_t { sha1, sha256, blake3 };
+
+/**
+ * hashAlgorithmOf - parses the name of a hash algorithm
+ * @name: "sha1", "sha256" or "blake3"
+ * @algorithm: set to the parsed algorithm
+ * Return: false if the name is unknown or the algorithm isn't built in
+ */
+bool hashAlgorithmOf(const string& name, HashAlgorithm& algorithm) {
+    if (name == "sha1") algorithm = HashAlgorithm::sha1;
+    else if (name == "sha256") algorithm = HashAlgorithm::sha256;
+#ifdef MINIGIT_BLAKE3
+    else if (name == "blake3") algorithm = HashAlgorithm::blake3;
+#endif
+    else return false;
+    return true;
+}
+
+/**
+ * digestSize - number of raw bytes in a digest
+ * @algorithm: the hash algorithm
+ * Return: digest size in bytes
+ */
+size_t digestSize(HashAlgorithm algorithm) {
+    return algorithm == HashAlgorithm::sha1 ? 20 : 32;
+}
+
+/**
+ * Digest - an incremental hash in one of the object hash algorithms
+ *
+ * OpenSSL contexts are pooled per thread and reset for each digest instead of
+ * being allocated every time; digests nested on one thread take their own.
+ */
+class Digest {
+private:
+    HashAlgorithm algorithm;
+    EVP_MD_CTX* ctx = nullptr;
+#ifdef MINIGIT_BLAKE3
+    blake3_hasher blake;
+#endif
+
+    static vector<EVP_MD_CTX*>& pool() {
+        struct Pool {
+            vector<EVP_MD_CTX*> contexts;
+            ~Pool() {
+                for (EVP_MD_CTX* context : contexts) EVP_MD_CTX_free(context);
+            }
+        };
+        static thread_local Pool pool;
+        return pool.contexts;
+    }
+
+public:
+    explicit Digest(HashAlgorithm algorithm) : algorithm(algorithm) {
+#ifdef MINIGIT_BLAKE3
+        if (algorithm == HashAlgorithm::blake3) {
+            blake3_hasher_init(&blake);
+            return;
+        }
+#endif
+        auto& contexts = pool();
+        if (contexts.empty()) {
+            ctx = EVP_MD_CTX_new();
+        } else {
+            ctx = contexts.back();
+            contexts.pop_back();
+        }
+        EVP_DigestInit_ex(ctx, algorithm == HashAlgorithm::sha256 ? EVP_sha256() : EVP_sha1(), nullptr);
     }
+    ~Digest() {
+        if (ctx) pool().push_back(ctx);
+    }
+    Digest(const Digest&) = delete;
+    Digest& operator=(const Digest&) = delete;
+
 /**
- * Author - gets the author of a branch
- * @branch: name of the branch
- * Return: author's name as string
+ * update - feeds bytes into the digest
+ * @data: the bytes
+ * @len: number of bytes
  */
-    string Author(const string& branch) {
-        path authorPath = repoPath / "authors" / branch;
-        ifstream in(authorPath);
-        string name;
-        if (in) getline(in, name);
-        return name;
+    void update(const void* data, size_t len) {
+#ifdef MINIGIT_BLAKE3
+        if (algorithm == HashAlgorithm::blake3) {
+            blake3_hasher_update(&blake, data, len);
+            return;
+        }
+#endif
+        EVP_DigestUpdate(ctx, data, len);
     }
 /**
- * commitString - converts the commit node to strings
- * @node: the commit node structure
- * Return: string of the commit content
+ * hex - finishes the digest
+ * Return: the digest as lowercase hex
  */
-    string commitString(const CommitNode& node) {
-        string commit;
-        commit += "stageSnapshot: " + node.stageSnap + "\n";
-        commit += "prevCommit: "    + node.prevCommit + "\n";
-        commit += "timestamp: "     + node.timestamp + "\n";
-        commit += "author: "        + node.author    + "\n";
-        commit += "comment: "       + node.comment   + "\n";
-        return commit;
+    string hex() {
+        unsigned char hash[EVP_MAX_MD_SIZE];
+        unsigned int len = digestSize(algorithm);
+#ifdef MINIGIT_BLAKE3
+        if (algorithm == HashAlgorithm::blake3) {
+            blake3_hasher_finalize(&blake, hash, len);
+            return hexOf(hash, len);
+        }
+#endif
+        EVP_DigestFinal_ex(ctx, hash, &len);
+        return hexOf(hash, len);
     }
+};
 
 /**
- * findHash - resolves a reference (branch or commit ID) into a valid commit hash
- * @targetName: the name of branch or commit ID
- * Return: resolved commit hash 
+ * StageEntry - a staged file's blob hash plus the stat data it was hashed
+ * under, so unchanged files can be recognised without reading them
  */
-    string findHash(const string& targetName) {
-        path branchPath = repoPath / "refs" / targetName;
-        path commitPath = repoPath / "commits" / targetName;
-    
-        if (exists(branchPath)) {
-            ifstream bStream(branchPath);
-            string commitID;
-            getline(bStream, commitID);
-            bStream.close();
-            return commitID;
+struct StageEntry {
+    string hash;
+    uint64_t size = 0;
+    uint64_t mtimeNs = 0;
+    uint64_t inode = 0;
+    uint64_t device = 0;
+};
+
+/**
+ * Compressor - streams bytes through zlib (or zstd when built with
+ * MINIGIT_ZSTD) into an output stream
+ */
+class Compressor {
+private:
+    ostream& out;
+    bool zstd = false;
+    z_stream zs{};
+#ifdef MINIGIT_ZSTD
+    ZSTD_CCtx* zctx = nullptr;
+#endif
+    vector<char> buffer = vector<char>(1 << 16);
+
+/**
+ * pump - runs the compressor over some input
+ * @data: input bytes
+ * @len: number of input bytes
+ * @last: true to flush the end of the stream
+ * Return: true if every produced byte was written
+ */
+    bool pump(const char* data, size_t len, bool last) {
+#ifdef MINIGIT_ZSTD
+        if (zstd) {
+            ZSTD_inBuffer in = { data, len, 0 };
+            size_t remaining;
+            do {
+                ZSTD_outBuffer zout = { buffer.data(), buffer.size(), 0 };
+                remaining = ZSTD_compressStream2(zctx, &zout, &in, last ? ZSTD_e_end : ZSTD_e_continue);
+                if (ZSTD_isError(remaining)) return false;
+                out.write(buffer.data(), zout.pos);
+            } while (last ? remaining != 0 : in.pos < in.size);
+            return bool(out);
         }
-    
-        if (exists(commitPath)) return targetName;
-    
-        cerr << "reference - " << targetName << " doesn't exist\n";
-        return "";
+#endif
+        zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+        zs.avail_in = len;
+        int status;
+        do {
+            zs.next_out = reinterpret_cast<Bytef*>(buffer.data());
+            zs.avail_out = buffer.size();
+            status = deflate(&zs, last ? Z_FINISH : Z_NO_FLUSH);
+            if (status == Z_STREAM_ERROR) return false;
+            out.write(buffer.data(), buffer.size() - zs.avail_out);
+        } while (zs.avail_out == 0 || (last && status != Z_STREAM_END));
+        return bool(out);
     }
+
+public:
 /**
- * recover - Restores files when provided a given commit ID
- * @commitID: ID of the commit to recover from
+ * Compressor - starts a compressed stream
+ * @out: stream receiving the compressed bytes
+ * @method: "zlib" or "zstd"
+ * @level: compression level of the method
  */
-    void recover(const string& commitID) {
-        unordered_map<string, string> stage = stageOf(commitID);
-        if (stage.empty()) {
-            cerr << "no stage found for the commit - " << commitID << "\n";
+    Compressor(ostream& out, const string& method, int level) : out(out) {
+#ifdef MINIGIT_ZSTD
+        if (method == "zstd") {
+            zstd = true;
+            zctx = ZSTD_createCCtx();
+            ZSTD_CCtx_setParameter(zctx, ZSTD_c_compressionLevel, level);
             return;
         }
-    
-        for (const auto& [relativePath, blobHash] : stage) {
-            path blobPath = repoPath / "objects" / blobHash;
-            path fullPath = repoPath.parent_path() / relativePath;
-    
-            create_directories(fullPath.parent_path());
-    
-            ifstream bStream(blobPath, ios::binary);
-            ofstream rStream(fullPath, ios::binary);
-            rStream << bStream.rdbuf();
-            bStream.close();
-            rStream.close();
+#endif
+        deflateInit(&zs, method == "zlib" ? level : Z_DEFAULT_COMPRESSION);
+    }
+
+    ~Compressor() {
+#ifdef MINIGIT_ZSTD
+        if (zstd) {
+            ZSTD_freeCCtx(zctx);
+            return;
         }
-    
-        cout << "Files are restored successfully from commit - " << commitID << "\n";
+#endif
+        deflateEnd(&zs);
     }
 
+    Compressor(const Compressor&) = delete;
+    Compressor& operator=(const Compressor&) = delete;
+
+    bool write(const char* data, size_t len) { return pump(data, len, false); }
+    bool finish() { return pump(nullptr, 0, true); }
+};
+
 /**
- * stageOf - transforms a stage from a commit ID into a map 
- * @commitID: hash of the commit
- * Return: map of staged files and their hashes
+ * Decompressor - inflates a zlib or zstd stream fed in arbitrary pieces,
+ * telling the two apart by the magic bytes at the start of the stream
  */
-    unordered_map<string, string> stageOf(const string& commitID) {
-        string stageHash = CommitData(commitID).stageSnap;
-        path stagePath = repoPath / "objects" / stageHash;
-        return stageOf(stagePath);
+class Decompressor {
+private:
+    bool started = false;
+    bool zstd = false;
+    bool ended = false;
+    z_stream zs{};
+#ifdef MINIGIT_ZSTD
+    ZSTD_DCtx* zctx = nullptr;
+#endif
+    vector<char> buffer = vector<char>(1 << 16);
+
+public:
+    Decompressor() = default;
+
+    ~Decompressor() {
+        if (!started) return;
+#ifdef MINIGIT_ZSTD
+        if (zstd) {
+            ZSTD_freeDCtx(zctx);
+            return;
+        }
+#endif
+        inflateEnd(&zs);
     }
 
+    Decompressor(const Decompressor&) = delete;
+    Decompressor& operator=(const Decompressor&) = delete;
+
 /**
- * CommitData - Loads commit details from a commit ID
- * @id: the commit hash
- * Return: CommitNode struct with data
+ * feed - decompresses a piece of the stream
+ * @data: compressed bytes
+ * @len: number of compressed bytes
+ * @sink: receives every decompressed piece, returns false to stop
+ * Return: false on corrupt input, including bytes past the end of a zlib
+ * stream, or when @sink stopped
  */
-    CommitNode CommitData(const string& id) {
-        CommitNode node;
-        node.id = id;
-    
-        path commitPath = repoPath / "commits" / id;
-        ifstream file(commitPath);
-        if (!file) {
-            cerr << "Unable to load the commit - " << id << "\n";
-            return node;
+    bool feed(const char* data, size_t len, const function<bool(const char*, size_t)>& sink) {
+        if (!started) {
+            started = true;
+            zstd = len >= 4 && memcmp(data, "\x28\xb5\x2f\xfd", 4) == 0;
+#ifdef MINIGIT_ZSTD
+            if (zstd) zctx = ZSTD_createDCtx();
+#else
+            if (zstd) return false;
+#endif
+            if (!zstd && inflateInit(&zs) != Z_OK) return false;
         }
-    
-        string line;
-        getline(file, line);
-        node.stageSnap = line.substr(string("stageSnapshot: ").size());
-    
-        getline(file, line);
-        node.prevCommit = line.substr(string("prevCommit: ").size());
-    
-        getline(file, line);
-        node.timestamp = line.substr(string("timestamp: ").size());
-    
-        getline(file, line);
-        node.author = line.substr(string("author: ").size());
-    
-        getline(file, line);
-        node.comment = line.substr(string("comment: ").size());
-    
-        return node;
+
+#ifdef MINIGIT_ZSTD
+        if (zstd) {
+            ZSTD_inBuffer in = { data, len, 0 };
+            while (in.pos < in.size) {
+                ZSTD_outBuffer zout = { buffer.data(), buffer.size(), 0 };
+                size_t status = ZSTD_decompressStream(zctx, &zout, &in);
+                if (ZSTD_isError(status)) return false;
+                if (zout.pos && !sink(buffer.data(), zout.pos)) return false;
+                ended = status == 0;
+            }
+            return true;
+        }
+#endif
+        zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+        zs.avail_in = len;
+        while (zs.avail_in > 0 && !ended) {
+            zs.next_out = reinterpret_cast<Bytef*>(buffer.data());
+            zs.avail_out = buffer.size();
+            int status = inflate(&zs, Z_NO_FLUSH);
+            if (status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR) return false;
+            size_t produced = buffer.size() - zs.avail_out;
+            if (produced && !sink(buffer.data(), produced)) return false;
+            ended = status == Z_STREAM_END;
+            if (status == Z_BUF_ERROR && produced == 0) break;
+        }
+        return !ended || zs.avail_in == 0;
     }
 
+    bool done() const { return ended; }
+};
+
 /**
- * manageConflict - resolves merge conflicts using a simple 3 way merge
- * @base: ancestor version of the file
- * @current: current version in active branch
- * @source: version from incoming branch
- * Return: resolved version or empty string if conflict remains
+ * cloneFile - copies a file with the cheapest mechanism the filesystem offers
+ * @from: source file
+ * @to: destination file, must not exist yet
+ * @mode: permission bits of the new file
+ * Return: true if the whole file was copied
+ *
+ * A FICLONE reflink is tried first, which shares the extents on CoW
+ * filesystems; then copy_file_range and sendfile, which keep the bytes in the
+ * kernel; and finally a buffered read/write loop.
  */
+bool cloneFile(const path& from, const path& to, mode_t mode) {
+    int in = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) return false;
+    struct stat st;
+    int out = fstat(in, &st) == 0 ? open(to.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, mode) : -1;
+    if (out < 0) {
+        close(in);
+        return false;
+    }
+
+    bool copied = false;
+#ifdef FICLONE
+    copied = ioctl(out, FICLONE, in) == 0;
+#endif
+    off_t done = 0;
+#ifdef __linux__
+    while (!copied) {
+        ssize_t n = copy_file_range(in, nullptr, out, nullptr, st.st_size - done, 0);
+        if (n <= 0) break;
+        done += n;
+        copied = done == st.st_size;
+    }
+    while (!copied && done == lseek(out, 0, SEEK_CUR)) {
+        off_t offset = done;
+        ssize_t n = sendfile(out, in, &offset, st.st_size - done);
+        if (n <= 0) break;
+        done += n;
+        copied = done == st.st_size;
+    }
+#endif
+    if (!copied && lseek(in, done, SEEK_SET) == done && lseek(out, done, SEEK_SET) == done) {
+        vector<char> buffer(1 << 16);
+        ssize_t n;
+        while ((n = read(in, buffer.data(), buffer.size())) > 0) {
+            if (write(out, buffer.data(), n) != n) break;
+            done += n;
+        }
+        copied = n == 0 && done == st.st_size;
+    }
 
-    string manageConflict(const string& base, const string& current, const string& source) {  
-    if (current == source || source.empty()) return current;  
-    if (current.empty())                     return source;  
-    if (base == current)                     return source;  
-    if (base == source)                      return current;  
-    return "";  
+    Tracer::add(Tracer::filesOpened, 2);
+    if (copied) Tracer::add(Tracer::bytesCopied, st.st_size);
+    close(in);
+    if (close(out) != 0) copied = false;
+    if (!copied) unlink(to.c_str());
+    return copied;
 }
 
 /**
- * mergeStage - records merged staging map to disk as temporary stage file
- * @stageMap: map of filename to blob hash
- * Return: path to the temporary stage file
+ * writeAll - writes a whole buffer to a file descriptor
+ * @fd: the file descriptor
+ * @data: bytes to write
+ * @len: number of bytes
+ * Return: true if every byte was written
  */
-    string mergeStage(const unordered_map<string, string>& stageMap) {  
-    string pathStr = (repoPath / "merge-stage").string();  
-    ofstream oStream(pathStr);  
-    for (const auto& [fileName, hash] : stageMap)  
-        oStream << fileName << " " << hash << "\n";  
-    oStream.close();  
-    return pathStr;  
-} 
+bool writeAll(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t written = ::write(fd, data, len);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+        data += written;
+        len -= written;
+    }
+    return true;
+}
 
 /**
- * time - Gets the current time as string
- * Return: timestamp string
+ * LockFile - an exclusive "<file>.lock" that replaces the file when committed
+ *
+ * Taking the lock fails while another process holds it. What is written to
+ * the lock becomes the file's content through an atomic rename on commit; a
+ * lock that is never committed is removed.
  */
-    string time() {
-    time_t now = chrono::system_clock::to_time_t(chrono::system_clock::now());
-    string t = ctime(&now);
-    t.pop_back();
-    return t;
-}
+class LockFile {
+private:
+    path target;
+    path lockPath;
+    int fd = -1;
 
+public:
 /**
- * commonAncestor - finds the first common ancestor between two commits
- * @commitA: first commit hash
- * @commitB: second commit hash
- * Return: common ancestor commit hash 
+ * LockFile - takes the lock of a file
+ * @file: the file to lock
  */
+    explicit LockFile(const path& file) : target(file), lockPath(file.string() + ".lock") {
+        fd = ::open(lockPath.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+    }
+    ~LockFile() {
+        if (fd < 0) return;
+        ::close(fd);
+        ::unlink(lockPath.c_str());
+    }
+    LockFile(const LockFile&) = delete;
+    LockFile& operator=(const LockFile&) = delete;
 
+    explicit operator bool() const { return fd >= 0; }
+    const path& file() const { return lockPath; }
 
-    string commonAncestor(const string& commitA, const string& commitB) {  
-    unordered_set<string> ancestorsA;  
-    queue<string> lineageA;  
-    lineageA.push(commitA);  
-  
-    while (!lineageA.empty()) {  
-        string commitID = lineageA.front(); lineageA.pop();  
-        if (!ancestorsA.insert(commitID).second) continue;  
-  
-        istringstream parentStream(CommitData(commitID).prevCommit);  
-        string parent;  
-        while (getline(parentStream, parent, ','))  
-            if (!parent.empty()) lineageA.push(parent);  
-    }  
-  
-    queue<string> lineageB;  
-    lineageB.push(commitB);  
+/**
+ * write - appends to the new content
+ * @content: the bytes
+ * Return: false if the lock isn't held or the write failed
+ */
+    bool write(string_view content) {
+        return fd >= 0 && writeAll(fd, content.data(), content.size());
+    }
+/**
+ * commit - replaces the file with the lock's content and releases the lock
+ * Return: true if the file was replaced
+ */
+    bool commit() {
+        if (fd < 0) return false;
+        bool closed = ::close(fd) == 0;
+        fd = -1;
+        if (closed && ::rename(lockPath.c_str(), target.c_str()) == 0) return true;
+        ::unlink(lockPath.c_str());
+        return false;
+    }
+};
+
+/**
+ * isStageFile - tells a branch's stage from temporary and lock files beside it
+ * @file: path of a file in the stages directory
+ * Return: true for a stage
+ */
+bool isStageFile(const path& file) {
+    string name = file.filename().string();
+    return name.compare(0, 5, ".tmp-") != 0
+        && (name.size() < 5 || name.compare(name.size() - 5, 5, ".lock") != 0);
+}
+
+/**
+ * MappedFile - read-only memory mapping of a whole file
+ */
+class MappedFile {
+private:
+    void* mapping = nullptr;
+    size_t length = 0;
+
+public:
+    MappedFile() = default;
+
+/**
+ * MappedFile - maps a file; stays empty if it is missing or empty
+ * @filePath: path to the file
+ */
+    explicit MappedFile(const path& filePath) {
+        int fd = open(filePath.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            length = st.st_size;
+            mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping == MAP_FAILED) {
+                mapping = nullptr;
+                length = 0;
+            }
+        }
+        close(fd);
+    }
+
+    MappedFile(MappedFile&& other) noexcept
+        : mapping(exchange(other.mapping, nullptr)), length(exchange(other.length, 0)) {}
+
+    MappedFile& operator=(MappedFile&& other) noexcept {
+        if (mapping) munmap(mapping, length);
+        mapping = exchange(other.mapping, nullptr);
+        length = exchange(other.length, 0);
+        return *this;
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { if (mapping) munmap(mapping, length); }
+
+    const char* data() const { return static_cast<const char*>(mapping); }
+    size_t size() const { return length; }
+    explicit operator bool() const { return mapping != nullptr; }
+};
+
+/**
+ * LruCache - thread-safe least-recently-used cache bounded by a byte budget
+ * @V: cached value type
+ */
+template <typename V>
+class LruCache {
+private:
+    using Item = pair<string, shared_ptr<const V>>;
+    size_t budget;
+    size_t used = 0;
+    function<size_t(const V&)> cost;
+    list<Item> order;
+    unordered_map<string, typename list<Item>::iterator> lookup;
+    mutex lock;
+
+public:
+/**
+ * LruCache - creates an empty cache
+ * @budget: total cost the cache may hold
+ * @cost: estimates the cost of a value in bytes
+ */
+    LruCache(size_t budget, function<size_t(const V&)> cost) : budget(budget), cost(move(cost)) {}
+
+/**
+ * get - looks a value up and marks it most recently used
+ * @key: cache key
+ * Return: the value, or nullptr if it is not cached
+ */
+    shared_ptr<const V> get(const string& key) {
+        lock_guard<mutex> guard(lock);
+        auto it = lookup.find(key);
+        if (it == lookup.end()) return nullptr;
+        order.splice(order.begin(), order, it->second);
+        return it->second->second;
+    }
+
+/**
+ * put - caches a value, evicting the least recently used ones over budget
+ * @key: cache key
+ * @value: value to cache; values larger than the whole budget are skipped
+ * Return: the cached value
+ */
+    shared_ptr<const V> put(const string& key, V value) {
+        auto shared = make_shared<const V>(move(value));
+        size_t size = cost(*shared);
+        if (size > budget) return shared;
+
+        lock_guard<mutex> guard(lock);
+        auto it = lookup.find(key);
+        if (it != lookup.end()) {
+            used -= cost(*it->second->second);
+            order.erase(it->second);
+            lookup.erase(it);
+        }
+        order.emplace_front(key, shared);
+        lookup[key] = order.begin();
+        used += size;
+        while (used > budget) {
+            used -= cost(*order.back().second);
+            lookup.erase(order.back().first);
+            order.pop_back();
+        }
+        return shared;
+    }
+
+    void clear() {
+        lock_guard<mutex> guard(lock);
+        order.clear();
+        lookup.clear();
+        used = 0;
+    }
+};
+
+/**
+ * putVarint - appends an unsigned LEB128 integer
+ * @out: buffer to append to
+ * @value: value to encode
+ */
+void putVarint(string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out += char(value | 0x80);
+        value >>= 7;
+    }
+    out += char(value);
+}
+
+/**
+ * getVarint - reads an unsigned LEB128 integer
+ * @in: buffer to read from
+ * @pos: read position, advanced past the integer
+ * @value: set to the decoded value
+ * Return: false if the buffer ends inside the integer
+ */
+bool getVarint(string_view in, size_t& pos, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; pos < in.size() && shift < 64; shift += 7) {
+        uint8_t byte = in[pos++];
+        value |= uint64_t(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+/**
+ * Chunker - content-defined chunk boundaries (FastCDC style gear hash)
+ *
+ * Boundaries depend only on the bytes before them, so an insert or append
+ * changes the chunks around it and leaves the rest of the file's chunks, and
+ * their objects, as they were. Below the average size a stricter mask is used
+ * and above it a looser one, which keeps chunk sizes close to the average.
+ */
+class Chunker {
+    static constexpr size_t minSize = 16 << 10, avgSize = 64 << 10;
+    static constexpr uint64_t strictMask = ((1ull << 18) - 1) << 46;
+    static constexpr uint64_t looseMask = ((1ull << 14) - 1) << 50;
+    uint64_t gear[256];
+
+public:
+    static constexpr size_t maxSize = 256 << 10;
+
+    Chunker() {
+        uint64_t seed = 0x9e3779b97f4a7c15ull;
+        for (auto& value : gear) {
+            uint64_t z = (seed += 0x9e3779b97f4a7c15ull);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+            value = z ^ (z >> 31);
+        }
+    }
+/**
+ * cut - finds the end of the chunk starting at @data
+ * @data: bytes from the start of the chunk
+ * @len: number of bytes available, at least maxSize unless the file ends sooner
+ * Return: length of the chunk
+ */
+    size_t cut(const char* data, size_t len) const {
+        len = min(len, maxSize);
+        if (len <= minSize) return len;
+        uint64_t hash = 0;
+        size_t i = minSize, normal = min(len, avgSize);
+        for (; i < normal; ++i) {
+            hash = (hash << 1) + gear[uint8_t(data[i])];
+            if (!(hash & strictMask)) return i + 1;
+        }
+        for (; i < len; ++i) {
+            hash = (hash << 1) + gear[uint8_t(data[i])];
+            if (!(hash & looseMask)) return i + 1;
+        }
+        return len;
+    }
+};
+
+/**
+ * deltaOf - encodes a target as copy/insert instructions against a base
+ * @base: content the delta refers to
+ * @target: content the delta reproduces
+ * Return: varint base size, varint target size, then instructions: a byte
+ * with the high bit set copies (varint offset, varint length) from the base,
+ * any other byte n inserts the n literal bytes that follow
+ *
+ * The base is indexed in 16-byte blocks; a match found through the index is
+ * extended forwards and backwards before it is emitted.
+ */
+string deltaOf(string_view base, string_view target) {
+    constexpr size_t block = 16;
+    auto blockHash = [](const char* data) {
+        uint64_t a, b;
+        memcpy(&a, data, 8);
+        memcpy(&b, data + 8, 8);
+        uint64_t h = (a ^ (b * 0x9e3779b97f4a7c15ull)) * 0xff51afd7ed558ccdull;
+        return h ^ (h >> 29);
+    };
+
+    size_t slots = 1024;
+    while (slots < base.size() / block * 2) slots <<= 1;
+    vector<uint32_t> table(slots, 0);
+    for (size_t i = 0; i + block <= base.size(); i += block)
+        table[blockHash(base.data() + i) & (slots - 1)] = i + 1;
+
+    string delta, pending;
+    putVarint(delta, base.size());
+    putVarint(delta, target.size());
+    auto flush = [&]() {
+        for (size_t i = 0; i < pending.size(); i += 127) {
+            size_t n = min<size_t>(127, pending.size() - i);
+            delta += char(n);
+            delta.append(pending, i, n);
+        }
+        pending.clear();
+    };
+
+    size_t pos = 0;
+    while (pos < target.size()) {
+        size_t matchOffset = 0, matchLength = 0;
+        if (pos + block <= target.size()) {
+            uint32_t slot = table[blockHash(target.data() + pos) & (slots - 1)];
+            if (slot) {
+                size_t offset = slot - 1, length = 0;
+                while (offset + length < base.size() && pos + length < target.size()
+                       && base[offset + length] == target[pos + length])
+                    ++length;
+                if (length >= block) {
+                    matchOffset = offset;
+                    matchLength = length;
+                }
+            }
+        }
+        if (!matchLength) {
+            pending += target[pos++];
+            continue;
+        }
+        pos += matchLength;
+        while (!pending.empty() && matchOffset > 0 && base[matchOffset - 1] == pending.back()) {
+            --matchOffset;
+            ++matchLength;
+            pending.pop_back();
+        }
+        flush();
+        delta += char(0x80);
+        putVarint(delta, matchOffset);
+        putVarint(delta, matchLength);
+    }
+    flush();
+    return delta;
+}
+
+/**
+ * applyDelta - rebuilds a target from its base and a delta made by deltaOf
+ * @base: the base content
+ * @delta: the delta instructions
+ * @out: set to the rebuilt content
+ * Return: false if the delta does not fit the base or is malformed
+ */
+bool applyDelta(string_view base, string_view delta, string& out) {
+    size_t pos = 0;
+    uint64_t baseSize, targetSize;
+    if (!getVarint(delta, pos, baseSize) || !getVarint(delta, pos, targetSize) || baseSize != base.size())
+        return false;
+
+    out.clear();
+    out.reserve(targetSize);
+    while (pos < delta.size()) {
+        uint8_t op = delta[pos++];
+        if (op & 0x80) {
+            uint64_t offset, length;
+            if (!getVarint(delta, pos, offset) || !getVarint(delta, pos, length)
+                || offset > base.size() || length > base.size() - offset)
+                return false;
+            out.append(base.data() + offset, length);
+        } else {
+            if (op == 0 || op > delta.size() - pos) return false;
+            out.append(delta.data() + pos, op);
+            pos += op;
+        }
+    }
+    return out.size() == targetSize;
+}
+
+/**
+ * LineText - a text split into lines, with equal lines sharing an id
+ */
+struct LineText {
+    vector<string_view> lines;
+    vector<uint32_t> ids;
+};
+
+/**
+ * splitLines - splits texts into lines and numbers the distinct lines
+ * @texts: texts to split; they must outlive the result
+ * Return: one LineText per text, ids comparable across all of them
+ *
+ * Lines keep their newline, so a last line without one differs from the
+ * same line with one. Comparing ids instead of strings keeps the diff loops
+ * down to integer compares.
+ */
+vector<LineText> splitLines(initializer_list<string_view> texts) {
+    unordered_map<string_view, uint32_t> idOf;
+    vector<LineText> result;
+    for (string_view text : texts) {
+        LineText split;
+        for (size_t pos = 0; pos < text.size();) {
+            size_t end = text.find('\n', pos);
+            end = end == string_view::npos ? text.size() : end + 1;
+            string_view line = text.substr(pos, end - pos);
+            split.lines.push_back(line);
+            split.ids.push_back(idOf.emplace(line, idOf.size()).first->second);
+            pos = end;
+        }
+        result.push_back(move(split));
+    }
+    return result;
+}
+
+/**
+ * myersMatch - shortest edit script between two line ranges (Myers O(ND))
+ * @a: line ids of the old range
+ * @n: length of @a
+ * @b: line ids of the new range
+ * @m: length of @b
+ * @matches: receives matched (old, new) index pairs relative to the ranges
+ * @limit: largest edit distance to search
+ * Return: false if the ranges differ by more than @limit edits
+ *
+ * Each round of the frontier is kept, so the path is traced back without a
+ * second search; @limit bounds that memory to O(limit^2).
+ */
+bool myersMatch(const uint32_t* a, int n, const uint32_t* b, int m,
+                vector<pair<size_t, size_t>>& matches, int limit) {
+    int maxD = min(n + m, limit), offset = maxD + 1;
+    vector<int> v(2 * maxD + 3, 0);
+    vector<vector<int>> trace;
+    int found = -1;
+    for (int d = 0; d <= maxD && found < 0; ++d) {
+        for (int k = -d; k <= d; k += 2) {
+            int x = (k == -d || (k != d && v[offset + k - 1] < v[offset + k + 1]))
+                  ? v[offset + k + 1] : v[offset + k - 1] + 1;
+            int y = x - k;
+            while (x < n && y < m && a[x] == b[y]) ++x, ++y;
+            v[offset + k] = x;
+            if (x >= n && y >= m) found = d;
+        }
+        trace.emplace_back(v.begin() + offset - d, v.begin() + offset + d + 1);
+    }
+    if (found < 0) return false;
+
+    vector<pair<size_t, size_t>> path;
+    int x = n, y = m;
+    for (int d = found; d > 0; --d) {
+        const vector<int>& previous = trace[d - 1];
+        auto at = [&](int k) { return previous[k + d - 1]; };
+        int k = x - y;
+        int prevK = (k == -d || (k != d && at(k - 1) < at(k + 1))) ? k + 1 : k - 1;
+        int prevX = at(prevK), prevY = prevX - prevK;
+        while (x > prevX && y > prevY) path.push_back({ --x, --y });
+        x = prevX;
+        y = prevY;
+    }
+    while (x > 0 && y > 0) path.push_back({ --x, --y });
+    matches.insert(matches.end(), path.rbegin(), path.rend());
+    return true;
+}
+
+/**
+ * linearMatch - shortest edit script between two line ranges in linear space
+ * @a: line ids of the old text
+ * @aBegin: first old line of the range
+ * @aEnd: end of the old range
+ * @b: line ids of the new text
+ * @bBegin: first new line of the range
+ * @bEnd: end of the new range
+ * @matches: receives matched (old, new) line index pairs in increasing order
+ *
+ * The middle snake of an optimal path is found by searching from both ends
+ * at once (Myers' linear space refinement) and the parts before and after it
+ * are matched recursively, so any edit distance fits in O(n + m) memory.
+ */
+void linearMatch(const vector<uint32_t>& a, size_t aBegin, size_t aEnd,
+                 const vector<uint32_t>& b, size_t bBegin, size_t bEnd,
+                 vector<pair<size_t, size_t>>& matches) {
+    while (aBegin < aEnd && bBegin < bEnd && a[aBegin] == b[bBegin])
+        matches.push_back({ aBegin++, bBegin++ });
+    size_t suffix = 0;
+    while (aBegin < aEnd - suffix && bBegin < bEnd - suffix && a[aEnd - suffix - 1] == b[bEnd - suffix - 1])
+        ++suffix;
+    aEnd -= suffix;
+    bEnd -= suffix;
+
+    if (aBegin < aEnd && bBegin < bEnd) {
+        const uint32_t* x0 = a.data() + aBegin;
+        const uint32_t* y0 = b.data() + bBegin;
+        long n = aEnd - aBegin, m = bEnd - bBegin, delta = n - m;
+        long maxD = (n + m + 1) / 2, offset = maxD + 1;
+        vector<long> forward(2 * maxD + 3, 0), backward(2 * maxD + 3, 0);
+        long snakeX = -1, snakeY = 0, snakeU = 0, snakeV = 0;
+        for (long d = 0; d <= maxD && snakeX < 0; ++d) {
+            for (long k = -d; k <= d && snakeX < 0; k += 2) {
+                long x = (k == -d || (k != d && forward[offset + k - 1] < forward[offset + k + 1]))
+                       ? forward[offset + k + 1] : forward[offset + k - 1] + 1;
+                long y = x - k, startX = x, startY = y;
+                while (x < n && y < m && x0[x] == y0[y]) ++x, ++y;
+                forward[offset + k] = x;
+                long c = delta - k;
+                if ((delta & 1) && c >= -(d - 1) && c <= d - 1 && x + backward[offset + c] >= n) {
+                    snakeX = startX, snakeY = startY, snakeU = x, snakeV = y;
+                }
+            }
+            for (long k = -d; k <= d && snakeX < 0; k += 2) {
+                long x = (k == -d || (k != d && backward[offset + k - 1] < backward[offset + k + 1]))
+                       ? backward[offset + k + 1] : backward[offset + k - 1] + 1;
+                long y = x - k, startX = x, startY = y;
+                while (x < n && y < m && x0[n - 1 - x] == y0[m - 1 - y]) ++x, ++y;
+                backward[offset + k] = x;
+                long c = delta - k;
+                if (!(delta & 1) && c >= -d && c <= d && x + forward[offset + c] >= n) {
+                    snakeX = n - x, snakeY = m - y, snakeU = n - startX, snakeV = m - startY;
+                }
+            }
+        }
+        linearMatch(a, aBegin, aBegin + snakeX, b, bBegin, bBegin + snakeY, matches);
+        for (long s = 0; s < snakeU - snakeX; ++s)
+            matches.push_back({ aBegin + snakeX + s, bBegin + snakeY + s });
+        linearMatch(a, aBegin + snakeU, aEnd, b, bBegin + snakeV, bEnd, matches);
+    }
+
+    for (size_t s = 0; s < suffix; ++s)
+        matches.push_back({ aEnd + s, bEnd + s });
+}
+
+/**
+ * matchLines - finds matching lines between two line ranges
+ * @a: line ids of the old text
+ * @aBegin: first old line of the range
+ * @aEnd: end of the old range
+ * @b: line ids of the new text
+ * @bBegin: first new line of the range
+ * @bEnd: end of the new range
+ * @matches: receives matched (old, new) line index pairs in increasing order
+ *
+ * Common prefix and suffix are matched directly. The middle is diffed with
+ * Myers while the edit distance stays small; past that, lines occurring
+ * exactly once on each side are taken as anchors (patience diff, longest
+ * increasing run) and the gaps between anchors are matched recursively.
+ * Without any such line the range goes to the linear space Myers search.
+ */
+void matchLines(const vector<uint32_t>& a, size_t aBegin, size_t aEnd,
+                const vector<uint32_t>& b, size_t bBegin, size_t bEnd,
+                vector<pair<size_t, size_t>>& matches) {
+    while (aBegin < aEnd && bBegin < bEnd && a[aBegin] == b[bBegin])
+        matches.push_back({ aBegin++, bBegin++ });
+    size_t suffix = 0;
+    while (aBegin < aEnd - suffix && bBegin < bEnd - suffix && a[aEnd - suffix - 1] == b[bEnd - suffix - 1])
+        ++suffix;
+    aEnd -= suffix;
+    bEnd -= suffix;
+
+    if (aBegin < aEnd && bBegin < bEnd) {
+        size_t first = matches.size();
+        if (myersMatch(a.data() + aBegin, aEnd - aBegin, b.data() + bBegin, bEnd - bBegin, matches, 1024)) {
+            for (size_t i = first; i < matches.size(); ++i)
+                matches[i].first += aBegin, matches[i].second += bBegin;
+        } else {
+            struct Count { size_t inA = 0, inB = 0, atA = 0, atB = 0; };
+            unordered_map<uint32_t, Count> counts;
+            for (size_t i = aBegin; i < aEnd; ++i) {
+                Count& count = counts[a[i]];
+                ++count.inA;
+                count.atA = i;
+            }
+            for (size_t j = bBegin; j < bEnd; ++j) {
+                auto found = counts.find(b[j]);
+                if (found == counts.end()) continue;
+                ++found->second.inB;
+                found->second.atB = j;
+            }
+            vector<pair<size_t, size_t>> unique;
+            for (size_t i = aBegin; i < aEnd; ++i) {
+                const Count& count = counts[a[i]];
+                if (count.inA == 1 && count.inB == 1) unique.push_back({ i, count.atB });
+            }
+
+            vector<size_t> tails, previous(unique.size(), SIZE_MAX);
+            for (size_t u = 0; u < unique.size(); ++u) {
+                auto pos = lower_bound(tails.begin(), tails.end(), unique[u].second,
+                                       [&](size_t t, size_t value) { return unique[t].second < value; });
+                if (pos != tails.begin()) previous[u] = *(pos - 1);
+                if (pos == tails.end()) tails.push_back(u);
+                else *pos = u;
+            }
+            vector<pair<size_t, size_t>> anchors;
+            for (size_t u = tails.empty() ? SIZE_MAX : tails.back(); u != SIZE_MAX; u = previous[u])
+                anchors.push_back(unique[u]);
+            reverse(anchors.begin(), anchors.end());
+            if (anchors.empty()) linearMatch(a, aBegin, aEnd, b, bBegin, bEnd, matches);
+
+            size_t i = aBegin, j = bBegin;
+            for (const auto& [anchorA, anchorB] : anchors) {
+                if (anchorA > i && anchorB > j) matchLines(a, i, anchorA, b, j, anchorB, matches);
+                matches.push_back({ anchorA, anchorB });
+                i = anchorA + 1;
+                j = anchorB + 1;
+            }
+            if (!anchors.empty() && i < aEnd && j < bEnd) matchLines(a, i, aEnd, b, j, bEnd, matches);
+        }
+    }
+
+    for (size_t s = 0; s < suffix; ++s)
+        matches.push_back({ aEnd + s, bEnd + s });
+}
+
+/**
+ * MergeResult - outcome of a line-level three-way merge
+ */
+struct MergeResult {
+    string text;
+    size_t conflicts = 0;
+};
+
+/**
+ * mergeLines - merges two edits of a common base line by line (diff3)
+ * @base: the common ancestor's content
+ * @current: the current branch's content
+ * @source: the merged branch's content
+ * @currentName: label for the current side of conflict markers
+ * @sourceName: label for the source side of conflict markers
+ * Return: merged text and the number of conflicting hunks
+ *
+ * Base lines matched on both sides split the files into stable and unstable
+ * chunks. An unstable chunk changed on one side only takes that side; one
+ * changed identically on both sides is taken once; anything else is written
+ * between conflict markers.
+ */
+MergeResult mergeLines(string_view base, string_view current, string_view source,
+                       const string& currentName, const string& sourceName) {
+    auto split = splitLines({ base, current, source });
+    const LineText &o = split[0], &a = split[1], &b = split[2];
+    vector<pair<size_t, size_t>> toA, toB;
+    matchLines(o.ids, 0, o.ids.size(), a.ids, 0, a.ids.size(), toA);
+    matchLines(o.ids, 0, o.ids.size(), b.ids, 0, b.ids.size(), toB);
+    vector<size_t> inA(o.ids.size() + 1, SIZE_MAX), inB(o.ids.size() + 1, SIZE_MAX);
+    for (const auto& [line, at] : toA) inA[line] = at;
+    for (const auto& [line, at] : toB) inB[line] = at;
+    inA[o.ids.size()] = a.ids.size();
+    inB[o.ids.size()] = b.ids.size();
+
+    MergeResult result;
+    auto append = [&](const LineText& text, size_t from, size_t to) {
+        for (size_t i = from; i < to; ++i) {
+            result.text.append(text.lines[i]);
+            if (i + 1 == to && text.lines[i].back() != '\n') result.text += '\n';
+        }
+    };
+    auto same = [](const LineText& x, size_t xFrom, size_t xTo, const LineText& y, size_t yFrom, size_t yTo) {
+        return xTo - xFrom == yTo - yFrom && equal(x.ids.begin() + xFrom, x.ids.begin() + xTo, y.ids.begin() + yFrom);
+    };
+
+    size_t lo = 0, la = 0, lb = 0;
+    while (lo <= o.ids.size()) {
+        if (lo < o.ids.size() && inA[lo] == la && inB[lo] == lb) {
+            result.text.append(o.lines[lo]);
+            ++lo, ++la, ++lb;
+            continue;
+        }
+        size_t next = lo;
+        while (next < o.ids.size() && (inA[next] == SIZE_MAX || inB[next] == SIZE_MAX)) ++next;
+        size_t ea = inA[next], eb = inB[next];
+
+        if (same(o, lo, next, a, la, ea)) {
+            for (size_t i = lb; i < eb; ++i) result.text.append(b.lines[i]);
+        } else if (same(o, lo, next, b, lb, eb) || same(a, la, ea, b, lb, eb)) {
+            for (size_t i = la; i < ea; ++i) result.text.append(a.lines[i]);
+        } else {
+            ++result.conflicts;
+            result.text += "<<<<<<< " + currentName + "\n";
+            append(a, la, ea);
+            result.text += "=======\n";
+            append(b, lb, eb);
+            result.text += ">>>>>>> " + sourceName + "\n";
+        }
+        if (next == o.ids.size()) break;
+        lo = next, la = ea, lb = eb;
+    }
+    return result;
+}
+
+/**
+ * unifiedDiff - renders the line differences of two texts as a unified diff
+ * @oldText: the old content
+ * @newText: the new content
+ * @context: unchanged lines shown around each change
+ * Return: the hunks ("@@ -l,n +l,n @@" and their lines), empty if equal
+ */
+string unifiedDiff(string_view oldText, string_view newText, size_t context = 3) {
+    auto split = splitLines({ oldText, newText });
+    const LineText &before = split[0], &after = split[1];
+    vector<pair<size_t, size_t>> matches;
+    matchLines(before.ids, 0, before.ids.size(), after.ids, 0, after.ids.size(), matches);
+    matches.push_back({ before.lines.size(), after.lines.size() });
+
+    struct Op {
+        char mark;
+        string_view line;
+        size_t oldLine, newLine;
+    };
+    vector<Op> ops;
+    size_t a = 0, b = 0;
+    for (const auto& [matchA, matchB] : matches) {
+        for (; a < matchA; ++a) ops.push_back({ '-', before.lines[a], a, b });
+        for (; b < matchB; ++b) ops.push_back({ '+', after.lines[b], a, b });
+        if (a == before.lines.size()) break;
+        ops.push_back({ ' ', before.lines[a], a, b });
+        ++a, ++b;
+    }
+
+    string out;
+    for (size_t op = 0; op < ops.size();) {
+        if (ops[op].mark == ' ') {
+            ++op;
+            continue;
+        }
+        size_t start = op - min(op, context), last = op;
+        for (size_t scan = op + 1; scan < ops.size() && scan <= last + 2 * context; ++scan)
+            if (ops[scan].mark != ' ') last = scan;
+        size_t end = min(ops.size(), last + 1 + context);
+
+        size_t oldCount = 0, newCount = 0;
+        for (size_t k = start; k < end; ++k) {
+            oldCount += ops[k].mark != '+';
+            newCount += ops[k].mark != '-';
+        }
+        size_t oldStart = ops[start].oldLine + (oldCount ? 1 : 0);
+        size_t newStart = ops[start].newLine + (newCount ? 1 : 0);
+        out += "@@ -" + to_string(oldStart) + "," + to_string(oldCount)
+             + " +" + to_string(newStart) + "," + to_string(newCount) + " @@\n";
+        for (size_t k = start; k < end; ++k) {
+            out += ops[k].mark;
+            out.append(ops[k].line);
+            if (ops[k].line.back() != '\n') out += "\n\\ No newline at end of file\n";
+        }
+        op = end;
+    }
+    return out;
+}
+
+/**
+ * Packfile format, written by gc:
+ *
+ *   pack     "MGPK", u32 version, u32 entry count, then per entry
+ *            u8 kind, u64 payload length, payload; then a SHA-1 trailer.
+ *            A kind 0 payload is the compressed object exactly as stored loose;
+ *            a kind 1 payload is the raw hash of a base blob followed by a
+ *            compressed deltaOf() from that base to the blob.
+ *   index    "MGIX", u32 version, u32 entry count, u32 hash length,
+ *            256 cumulative u32 fan-out counts by first hash byte,
+ *            sorted raw hashes, u64 pack offsets in the same order,
+ *            the pack's trailer and a SHA-1 trailer of the index itself
+ */
+static constexpr char packMagic[4] = {'M', 'G', 'P', 'K'};
+static constexpr char packIndexMagic[4] = {'M', 'G', 'I', 'X'};
+static constexpr uint32_t packVersion = 1;
+static constexpr size_t packHeaderSize = 12;
+static constexpr size_t packIndexHeaderSize = 16 + 256 * 4;
+static constexpr uint8_t packWhole = 0;
+static constexpr uint8_t packDelta = 1;
+
+/**
+ * PackFile - an mmap'ed packfile and its index
+ *
+ * Lookups use the fan-out table to narrow the range, then binary search the
+ * sorted hashes, so finding an object costs no system calls.
+ */
+class PackFile {
+private:
+    MappedFile index;
+    MappedFile pack;
+    uint32_t count = 0;
+    uint32_t hashLen = 0;
+
+    template <typename T>
+    T get(const MappedFile& file, size_t offset) const {
+        T value;
+        memcpy(&value, file.data() + offset, sizeof(value));
+        return value;
+    }
+
+public:
+    path indexPath;
+    path packPath;
+
+/**
+ * PackFile - maps a pack index and the pack next to it
+ * @idxPath: path to the .idx file
+ */
+    explicit PackFile(const path& idxPath)
+        : index(idxPath), pack(path(idxPath).replace_extension(".pack")),
+          indexPath(idxPath), packPath(path(idxPath).replace_extension(".pack")) {
+        if (!index || !pack || index.size() < packIndexHeaderSize
+            || memcmp(index.data(), packIndexMagic, 4) != 0 || get<uint32_t>(index, 4) != packVersion
+            || pack.size() < packHeaderSize + checksumSize || memcmp(pack.data(), packMagic, 4) != 0)
+            return;
+        uint32_t entries = get<uint32_t>(index, 8);
+        hashLen = get<uint32_t>(index, 12);
+        if (index.size() != packIndexHeaderSize + size_t(entries) * (hashLen + 8) + 2 * checksumSize)
+            return;
+        count = entries;
+    }
+
+    bool valid() const { return count > 0; }
+    size_t size() const { return count; }
+
+    string_view hashAt(size_t i) const {
+        return string_view(index.data() + packIndexHeaderSize + i * hashLen, hashLen);
+    }
+
+    uint64_t offsetAt(size_t i) const {
+        return get<uint64_t>(index, packIndexHeaderSize + size_t(count) * hashLen + i * 8);
+    }
+
+/**
+ * find - looks up an object by raw hash
+ * @raw: raw hash bytes
+ * Return: index of the entry, or size() if the pack does not hold it
+ */
+    size_t find(string_view raw) const {
+        if (raw.size() != hashLen) return count;
+        uint8_t first = raw[0];
+        size_t lo = first ? get<uint32_t>(index, 16 + (first - 1) * 4) : 0;
+        size_t hi = get<uint32_t>(index, 16 + first * 4);
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (hashAt(mid) < raw) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo < count && hashAt(lo) == raw ? lo : count;
+    }
+
+/**
+ * entryAt - reads the entry stored at an offset
+ * @offset: pack offset of the entry
+ * @kind: set to the entry kind
+ * @payload: set to the entry payload inside the mapping
+ * Return: false if the entry runs past the end of the pack
+ */
+    bool entryAt(uint64_t offset, uint8_t& kind, string_view& payload) const {
+        size_t end = pack.size() - checksumSize;
+        if (offset + 9 > end) return false;
+        kind = pack.data()[offset];
+        uint64_t length = get<uint64_t>(pack, offset + 1);
+        if (length > end - offset - 9) return false;
+        payload = string_view(pack.data() + offset + 9, length);
+        return true;
+    }
+};
+
+/**
+ * Binary stage format, shared by stages/<branch> and commit snapshots:
+ *
+ *   header   "MGST", u32 version, u32 entry count, u32 hash length
+ *   records  one fixed-size record per entry, sorted by path:
+ *            u64 size, u64 mtime (ns), u64 inode, u64 device,
+ *            u32 path offset, u32 path length, raw hash, zero padding to 8
+ *   paths    the path bytes the records point into
+ *   trailer  SHA-1 of everything before it
+ *
+ * Snapshots leave the stat fields zeroed, so identical stages hash identically.
+ */
+static constexpr char stageMagic[4] = {'M', 'G', 'S', 'T'};
+static constexpr uint32_t stageVersion = 1;
+static constexpr size_t stageHeaderSize = 16;
+
+/**
+ * StageWriter - encodes stage entries into the binary stage format
+ *
+ * Entries must be added in path order.
+ */
+class StageWriter {
+private:
+    string records;
+    string paths;
+    uint32_t count = 0;
+    uint32_t hashLen = 0;
+
+    template <typename T>
+    void put(string& out, T value) {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+public:
+/**
+ * add - appends an entry to the stage
+ * @file: path of the file relative to the repository root
+ * @hash: raw blob hash
+ * @stat: entry carrying the stat data, or nullptr to leave it zeroed
+ */
+    void add(string_view file, string_view hash, const StageEntry* stat = nullptr) {
+        if (count == 0) hashLen = hash.size();
+        put<uint64_t>(records, stat ? stat->size : 0);
+        put<uint64_t>(records, stat ? stat->mtimeNs : 0);
+        put<uint64_t>(records, stat ? stat->inode : 0);
+        put<uint64_t>(records, stat ? stat->device : 0);
+        put<uint32_t>(records, paths.size());
+        put<uint32_t>(records, file.size());
+        records.append(hash.data(), hash.size());
+        records.append((8 - hash.size() % 8) % 8, '\0');
+        paths.append(file.data(), file.size());
+        ++count;
+    }
+/**
+ * finish - lays out the header, records, paths and trailer
+ * Return: the encoded stage
+ */
+    string finish() {
+        string out(stageMagic, sizeof(stageMagic));
+        put<uint32_t>(out, stageVersion);
+        put<uint32_t>(out, count);
+        put<uint32_t>(out, count ? hashLen : 20);
+        out += records;
+        out += paths;
+        out += checksumOf(out.data(), out.size());
+        return out;
+    }
+};
+
+/**
+ * StageView - read-only, binary-searchable view over an encoded stage
+ *
+ * Stage files and snapshot objects are mmap'ed and read in place; entries
+ * are decoded on access without any per-entry allocation. Legacy text stages
+ * ("file hash" lines) are converted in memory on load.
+ */
+class StageView {
+public:
+    struct Entry {
+        string_view path;
+        string_view hash;
+    };
+
+private:
+    MappedFile mapping;
+    string owned;
+    const char* data = nullptr;
+    size_t length = 0;
+    uint32_t count = 0;
+    uint32_t hashLen = 0;
+    size_t recordSize = 0;
+    size_t pathsStart = 0;
+
+    template <typename T>
+    T get(size_t offset) const {
+        T value;
+        memcpy(&value, data + offset, sizeof(value));
+        return value;
+    }
+
+/**
+ * parse - validates the header and every record's bounds
+ * Return: true if the buffer holds a well-formed stage
+ */
+    bool parse() {
+        if (length < stageHeaderSize + checksumSize || memcmp(data, stageMagic, sizeof(stageMagic)) != 0)
+            return false;
+        if (get<uint32_t>(4) != stageVersion) return false;
+        count = get<uint32_t>(8);
+        hashLen = get<uint32_t>(12);
+        recordSize = 40 + hashLen + (8 - hashLen % 8) % 8;
+        pathsStart = stageHeaderSize + size_t(count) * recordSize;
+        if (pathsStart > length - checksumSize) return false;
+
+        size_t pathsLength = length - checksumSize - pathsStart;
+        for (uint32_t i = 0; i < count; ++i) {
+            size_t record = stageHeaderSize + i * recordSize;
+            if (uint64_t(get<uint32_t>(record + 32)) + get<uint32_t>(record + 36) > pathsLength)
+                return false;
+        }
+        return true;
+    }
+
+/**
+ * convertText - re-encodes a legacy text stage into the binary format
+ * @text: the "file hash" lines
+ */
+    void convertText(string_view text) {
+        vector<pair<string, string>> entries;
+        istringstream sStream{string(text)};
+        string line;
+        while (getline(sStream, line)) {
+            istringstream lStream(line);
+            string file, hash;
+            if (lStream >> file >> hash)
+                entries.emplace_back(file, rawOf(hash));
+        }
+        sort(entries.begin(), entries.end());
+        entries.erase(unique(entries.begin(), entries.end(),
+            [](const auto& a, const auto& b) { return a.first == b.first; }), entries.end());
+
+        StageWriter writer;
+        for (const auto& [file, hash] : entries)
+            writer.add(file, hash);
+        owned = writer.finish();
+        data = owned.data();
+        length = owned.size();
+        parse();
+    }
+
+public:
+    StageView() = default;
+
+/**
+ * StageView - views a stage held in memory, such as a decompressed snapshot
+ * @content: the encoded (or legacy text) stage
+ */
+    explicit StageView(string content) {
+        if (content.compare(0, sizeof(stageMagic), stageMagic, sizeof(stageMagic)) != 0) {
+            convertText(content);
+            return;
+        }
+        owned = move(content);
+        data = owned.data();
+        length = owned.size();
+        if (!parse()) {
+            data = nullptr;
+            length = count = 0;
+        }
+    }
+
+/**
+ * StageView - maps a stage file
+ * @stagePath: path to the stage or snapshot file
+ * @verify: check the trailing checksum as well
+ */
+    StageView(const path& stagePath, bool verify) : mapping(stagePath) {
+        if (!mapping) return;
+
+        data = mapping.data();
+        length = mapping.size();
+        if (memcmp(data, stageMagic, min(sizeof(stageMagic), length)) != 0) {
+            convertText(string_view(data, length));
+            mapping = MappedFile();
+            return;
+        }
+        if (!parse() || (verify && checksumOf(data, length - checksumSize) != string(data + length - checksumSize, checksumSize))) {
+            cerr << "Corrupt stage file - " << stagePath.string() << "\n";
+            mapping = MappedFile();
+            data = nullptr;
+            length = count = 0;
+        }
+    }
+
+    StageView(StageView&& other) noexcept { *this = move(other); }
+
+    StageView& operator=(StageView&& other) noexcept {
+        mapping = move(other.mapping);
+        owned = move(other.owned);
+        data = mapping ? mapping.data() : owned.empty() ? other.data : owned.data();
+        length = other.length;
+        count = exchange(other.count, 0);
+        hashLen = other.hashLen;
+        recordSize = other.recordSize;
+        pathsStart = other.pathsStart;
+        return *this;
+    }
+
+    StageView(const StageView&) = delete;
+    StageView& operator=(const StageView&) = delete;
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    size_t bytes() const { return length; }
+
+/**
+ * operator[] - decodes the entry at a position
+ * @i: entry index, in path order
+ * Return: entry pointing into the mapped data
+ */
+    Entry operator[](size_t i) const {
+        size_t record = stageHeaderSize + i * recordSize;
+        Entry entry;
+        entry.path = string_view(data + pathsStart + get<uint32_t>(record + 32), get<uint32_t>(record + 36));
+        entry.hash = string_view(data + record + 40, hashLen);
+        return entry;
+    }
+
+/**
+ * statAt - decodes the cached stat data of an entry
+ * @i: entry index
+ * Return: stage entry with hex hash and stat fields
+ */
+    StageEntry statAt(size_t i) const {
+        size_t record = stageHeaderSize + i * recordSize;
+        StageEntry entry;
+        entry.hash    = hexOf((*this)[i].hash);
+        entry.size    = get<uint64_t>(record);
+        entry.mtimeNs = get<uint64_t>(record + 8);
+        entry.inode   = get<uint64_t>(record + 16);
+        entry.device  = get<uint64_t>(record + 24);
+        return entry;
+    }
+
+/**
+ * find - binary searches an entry by path
+ * @file: path relative to the repository root
+ * Return: entry index, or size() if the path is not staged
+ */
+    size_t find(string_view file) const {
+        size_t lo = 0, hi = count;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if ((*this)[mid].path < file) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo < count && (*this)[lo].path == file ? lo : count;
+    }
+/**
+ * holdsBelow - checks whether any staged path lies below a directory
+ * @dir: path of the directory, ending in '/'
+ * Return: true if some entry's path starts with @dir
+ */
+    bool holdsBelow(string_view dir) const {
+        size_t lo = 0, hi = count;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if ((*this)[mid].path < dir) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo < count && (*this)[lo].path.compare(0, dir.size(), dir) == 0;
+    }
+};
+
+/**
+ * joinStages - walks any number of stages together in path order
+ * @stages: the stages, each sorted by path
+ * @visit: called once per path with the path and, for each stage, the
+ * entry's index or that stage's size() where the path is missing
+ *
+ * Every stage is scanned once, front to back.
+ */
+void joinStages(const vector<const StageView*>& stages,
+                const function<void(string_view, const vector<size_t>&)>& visit) {
+    vector<size_t> cursor(stages.size(), 0), at(stages.size());
+    while (true) {
+        string_view file;
+        bool more = false;
+        for (size_t s = 0; s < stages.size(); ++s)
+            if (cursor[s] < stages[s]->size()) {
+                string_view candidate = (*stages[s])[cursor[s]].path;
+                if (!more || candidate < file) file = candidate;
+                more = true;
+            }
+        if (!more) return;
+
+        for (size_t s = 0; s < stages.size(); ++s)
+            at[s] = cursor[s] < stages[s]->size() && (*stages[s])[cursor[s]].path == file
+                  ? cursor[s]++ : stages[s]->size();
+        visit(file, at);
+    }
+}
+
+/**
+ * TreeEntry - one child of a tree object
+ *
+ * A tree object lists the children of one directory, each as a kind byte
+ * ('d' for a subtree, 'f' for a blob), the name, a NUL and the raw hash.
+ * Children are ordered as if directory names ended in '/', so walking a
+ * tree depth-first yields paths in the same order as a stage.
+ */
+struct TreeEntry {
+    string_view name;
+    bool dir;
+    string_view raw;
+
+    string key() const { return dir ? string(name) + '/' : string(name); }
+};
+
+/**
+ * parseTree - decodes the children of a tree object
+ * @content: the tree object content
+ * @hashLen: size of the raw hashes
+ * @entries: receives the children, viewing into @content
+ * Return: false if the content is malformed
+ */
+bool parseTree(string_view content, size_t hashLen, vector<TreeEntry>& entries) {
+    entries.clear();
+    for (size_t pos = 0; pos < content.size();) {
+        size_t nul = content.find('\0', pos + 1);
+        if ((content[pos] != 'd' && content[pos] != 'f') || nul == string_view::npos
+            || nul + 1 + hashLen > content.size())
+            return false;
+        entries.push_back({ content.substr(pos + 1, nul - pos - 1), content[pos] == 'd',
+                            content.substr(nul + 1, hashLen) });
+        pos = nul + 1 + hashLen;
+    }
+    return true;
+}
+
+/**
+ * SparsePatterns - the part of the tree a sparse checkout materializes
+ *
+ * A pattern without wildcards is a cone: the file or directory at that path
+ * and everything below it. Any other pattern is a glob matched against the
+ * whole path, with '*' not crossing '/'. Without patterns everything matches.
+ */
+class SparsePatterns {
+private:
+    vector<string> cones;
+    vector<string> globs;
+
+public:
+    SparsePatterns() = default;
+    explicit SparsePatterns(const vector<string>& patterns) {
+        for (string pattern : patterns) {
+            while (pattern.compare(0, 2, "./") == 0) pattern.erase(0, 2);
+            if (!pattern.empty() && pattern[0] == '/') pattern.erase(0, 1);
+            while (!pattern.empty() && pattern.back() == '/') pattern.pop_back();
+            if (pattern.empty()) continue;
+            if (pattern.find_first_of("*?[") == string::npos)
+                cones.push_back(pattern + '/');
+            else
+                globs.push_back(pattern);
+        }
+    }
+
+    bool empty() const { return cones.empty() && globs.empty(); }
+
+/**
+ * matches - tells whether a file is part of the sparse checkout
+ * @file: path of the file
+ * Return: true if the file is materialized
+ */
+    bool matches(string_view file) const {
+        if (empty()) return true;
+        for (const string& cone : cones)
+            if (file.compare(0, cone.size(), cone) == 0 || file == string_view(cone).substr(0, cone.size() - 1))
+                return true;
+        string name(file);
+        for (const string& glob : globs)
+            if (fnmatch(glob.c_str(), name.c_str(), FNM_PATHNAME) == 0) return true;
+        return false;
+    }
+/**
+ * enters - tells whether anything below a directory can match
+ * @dir: path of the directory, ending in '/'
+ * Return: false if the whole directory lies outside the sparse checkout
+ */
+    bool enters(string_view dir) const {
+        if (empty()) return true;
+        auto overlaps = [&](string_view prefix) {
+            size_t common = min(prefix.size(), dir.size());
+            return prefix.compare(0, common, dir.substr(0, common)) == 0;
+        };
+        for (const string& cone : cones)
+            if (overlaps(cone)) return true;
+        for (const string& glob : globs) {
+            size_t slash = glob.rfind('/', glob.find_first_of("*?["));
+            if (overlaps(string_view(glob).substr(0, slash == string::npos ? 0 : slash + 1))) return true;
+        }
+        return false;
+    }
+};
+
+/**
+ * TreeConflict - a file changed differently on both sides of a merge
+ */
+struct TreeConflict {
+    string path;
+    string base;
+    string current;
+    string source;
+};
+
+/**
+ * PackSource - one object on its way into a new pack
+ */
+struct PackSource {
+    string raw;
+    string type;
+    uint64_t size = 0;
+    uint64_t wholeSize = 0;
+    uint8_t kind = 0;
+    string base;
+    function<string()> payload;
+    shared_ptr<string> delta;
+};
+
+/**
+ * GraphNode - a commit's place in the commit graph
+ */
+struct GraphNode {
+    string raw;
+    uint32_t parents[2];
+    uint32_t generation;
+};
+
+static constexpr char graphMagic[4] = {'C', 'G', 'P', 'H'};
+static constexpr uint32_t graphVersion = 1;
+static constexpr size_t graphHeaderSize = 12;
+static constexpr size_t graphRecordExtra = 12;
+static constexpr uint32_t noCommit = 0xffffffff;
+
+static constexpr char filterMagic[4] = {'C', 'P', 'B', 'F'};
+static constexpr uint32_t filterVersion = 1;
+static constexpr size_t filterHeaderSize = 12;
+static constexpr size_t filterBitsPerPath = 10;
+static constexpr size_t filterMaxPaths = 512;
+static constexpr int filterHashes = 7;
+
+/**
+ * pathBits - positions of a path's bits in a changed-path filter
+ * @path: the path
+ * @bits: size of the filter in bits
+ * @visit: receives each bit position
+ *
+ * The filterHashes positions come from double hashing a 64-bit FNV-1a of
+ * the path.
+ */
+void pathBits(string_view path, size_t bits, const function<void(size_t)>& visit) {
+    uint64_t h1 = 0xcbf29ce484222325ull;
+    for (char c : path)
+        h1 = (h1 ^ uint8_t(c)) * 0x100000001b3ull;
+    uint64_t h2 = ((h1 >> 33) | (h1 << 31)) * 0x9e3779b97f4a7c15ull | 1;
+    for (int k = 0; k < filterHashes; ++k)
+        visit((h1 + k * h2) % bits);
+}
+
+/**
+ * buildPathFilter - builds the Bloom filter of the paths a commit changed
+ * @files: the changed files
+ * Return: the filter bytes
+ *
+ * Every directory above a changed file is added too, so directories can be
+ * queried like files. A commit changing more than filterMaxPaths paths gets
+ * a single all-ones byte, which matches everything.
+ */
+string buildPathFilter(const vector<string>& files) {
+    unordered_set<string_view> paths;
+    for (const string& file : files)
+        for (size_t end = file.size(); end != string::npos && end > 0; end = file.rfind('/', end - 1))
+            if (!paths.insert(string_view(file).substr(0, end)).second) break;
+    if (paths.size() > filterMaxPaths) return string(1, '\xff');
+    if (paths.empty()) return "";
+
+    size_t bits = max<size_t>(64, (paths.size() * filterBitsPerPath + 7) / 8 * 8);
+    string filter(bits / 8, '\0');
+    for (string_view path : paths)
+        pathBits(path, bits, [&](size_t bit) { filter[bit / 8] |= char(1 << (bit % 8)); });
+    return filter;
+}
+
+/**
+ * filterMayContain - checks a path against a changed-path filter
+ * @filter: the filter bytes
+ * @path: the file or directory
+ * Return: false if the commit certainly didn't change @path
+ */
+bool filterMayContain(string_view filter, string_view path) {
+    if (filter.empty()) return false;
+    bool found = true;
+    pathBits(path, filter.size() * 8, [&](size_t bit) { found = found && (filter[bit / 8] >> (bit % 8) & 1); });
+    return found;
+}
+
+struct CommitNode {
+    string id;
+    string stageSnap;
+    string prevCommit;
+    string timestamp;
+    string author;
+    string comment;
+};
+
+class MinGit {
+private:
+    path repoPath;
+    string repoName;
+    string author;
+    unordered_map<string, string> config;
+    atomic<bool> configLoaded{false};
+    HashAlgorithm objectHash = HashAlgorithm::sha1;
+    string hashName = "sha1";
+    bool hashKnown = true;
+    vector<string> ignores;
+    atomic<bool> ignoresLoaded{false};
+    SparsePatterns sparse;
+    atomic<bool> sparseLoaded{false};
+    unordered_map<string, string> legacyTrees;
+    vector<unique_ptr<PackFile>> packs;
+    atomic<bool> packsLoaded{false};
+    mutex loadLock;
+    vector<GraphNode> graph;
+    unordered_map<string, uint32_t> graphIndex;
+    bool graphLoaded = false;
+    size_t graphBytes = 0;
+    unordered_map<string, string> pathFilters;
+    bool pathFiltersLoaded = false;
+    size_t pathFilterBytes = 0;
+    string pendingFilters;
+    mutex syncLock;
+    vector<path> unsyncedFiles;
+    unordered_set<string> unsyncedDirs;
+    unordered_map<string, pair<StageEntry, string>> refCache;
+    LruCache<CommitNode> commitCache{8 << 20, [](const CommitNode& node) {
+        return sizeof(CommitNode) + node.id.size() + node.stageSnap.size() + node.prevCommit.size()
+             + node.timestamp.size() + node.author.size() + node.comment.size();
+    }};
+    LruCache<StageView> snapshotCache{128 << 20, [](const StageView& stage) { return stage.bytes() + 64; }};
+    LruCache<string> deltaBases{64 << 20, [](const string& content) { return content.size() + 64; }};
+
+    static constexpr size_t chunkSize = 1 << 16;
+
+
+/**
+ * recordAuthor - registers the author and associates it with a branch name
+ * @branch: the name of the branch
+ * @author: the author name to be recorded
+ */
+    void recordAuthor(const string& branch, const string& author) {
+        writeRef(repoPath / "authors" / branch, author);
+    }
+/**
+ * refValue - reads the first line of HEAD, a ref or an author file
+ * @refPath: path to the file
+ * @found: set to whether the file exists, if not nullptr
+ * Return: the first line of the file
+ *
+ * Values are cached against the file's size, mtime and inode, so repeated
+ * reads within a session cost one stat. Files modified within the last
+ * 100ms are not cached, as another writer could still change them within
+ * the same timestamp tick.
+ */
+    string refValue(const path& refPath, bool* found = nullptr) {
+        StageEntry current;
+        bool present = statOf(refPath, current);
+        if (found) *found = present;
+        if (!present) return "";
+
+        auto cached = refCache.find(refPath.string());
+        if (cached != refCache.end() && cached->second.first.size == current.size
+            && cached->second.first.mtimeNs == current.mtimeNs && cached->second.first.inode == current.inode)
+            return cached->second.second;
+
+        ifstream in(refPath);
+        string value;
+        getline(in, value);
+
+        uint64_t now = chrono::duration_cast<chrono::nanoseconds>(
+            chrono::system_clock::now().time_since_epoch()).count();
+        if (current.mtimeNs + 100000000ull < now)
+            refCache[refPath.string()] = { current, value };
+        else
+            refCache.erase(refPath.string());
+        return value;
+    }
+/**
+ * writeRef - replaces HEAD, a ref or an author file and refreshes its cache entry
+ * @refPath: path to the file
+ * @value: the new content
+ * @expected: content the file must still have, "" for absent, or nullptr to
+ * replace it unconditionally
+ * Return: false if the file is locked, has moved on, or couldn't be written
+ *
+ * The new value goes to "<file>.lock", which is created exclusively, and is
+ * renamed over the file once everything written so far is durable. Two
+ * processes updating the same ref thus never both succeed against the same
+ * old value, while different refs are updated independently.
+ */
+    bool writeRef(const path& refPath, const string& value, const string* expected = nullptr) {
+        LockFile lock(refPath);
+        if (!lock) {
+            cerr << "Unable to lock " << refPath.filename().string() << ", another process is updating it\n";
+            return false;
+        }
+        if (expected) {
+            ifstream in(refPath);
+            string current;
+            getline(in, current);
+            if (current != *expected) {
+                cerr << refPath.filename().string() << " moved to " << (current.empty() ? "nothing" : current)
+                     << " while this command ran\n";
+                return false;
+            }
+        }
+        if (!lock.write(value)) {
+            cerr << "Unable to write " << refPath.filename().string() << "\n";
+            return false;
+        }
+        pendingSync(lock.file());
+        syncWrites();
+        if (!lock.commit()) {
+            cerr << "Unable to update " << refPath.filename().string() << "\n";
+            return false;
+        }
+        {
+            lock_guard<mutex> guard(syncLock);
+            unsyncedDirs.insert(refPath.parent_path().string());
+        }
+
+        StageEntry current;
+        if (statOf(refPath, current))
+            refCache[refPath.string()] = { current, value.substr(0, value.find('\n')) };
+        else
+            refCache.erase(refPath.string());
+        return true;
+    }
+/**
+ * writeFile - replaces a file through a temporary file and a rename
+ * @target: the file
+ * @content: its new content
+ * Return: true if the file was replaced
+ */
+    bool writeFile(const path& target, const string& content) {
+        path tempPath = tempFile(target.parent_path());
+        int fd = ::open(tempPath.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+        if (fd < 0) return false;
+        bool written = writeAll(fd, content.data(), content.size());
+        written = ::close(fd) == 0 && written;
+        error_code ec;
+        if (written) rename(tempPath, target, ec);
+        if (!written || ec) {
+            remove(tempPath, ec);
+            return false;
+        }
+        pendingSync(target);
+        return true;
+    }
+/**
+ * pendingSync - queues a written file for the next syncWrites
+ * @file: the file
+ */
+    void pendingSync(const path& file) {
+        lock_guard<mutex> guard(syncLock);
+        unsyncedFiles.push_back(file);
+        unsyncedDirs.insert(file.parent_path().string());
+    }
+/**
+ * stageOf - maps a stage from a stage file path
+ * @stagePath: path to the stage snapshot file
+ * Return: view of staged files and their hashes, sorted by path
+ */
+    StageView stageOf(const path& stagePath) {
+        return StageView(stagePath, false);
+    }
+/**
+ * indexOf - maps the stage of a branch together with its cached stat data
+ * @branch: the branch name
+ * @indexTime: set to the stage file's modification time in nanoseconds
+ * Return: view of the staged files, sorted by path
+ *
+ * A branch without a stage yet starts from the snapshot of its latest commit.
+ */
+    shared_ptr<const StageView> indexOf(const string& branch, uint64_t& indexTime) {
+        path stagePath = repoPath / "stages" / branch;
+        indexTime = 0;
+        StageEntry stageStat;
+        if (statOf(stagePath, stageStat))
+            indexTime = stageStat.mtimeNs;
+
+        auto stage = make_shared<const StageView>(stagePath, true);
+        string commitID = latestCommit(branch);
+        if (stage->empty() && !commitID.empty()) return stageOf(commitID);
+        return stage;
+    }
+/**
+ * statOf - reads the stat data of a file into a stage entry
+ * @filePath: path to the file
+ * @entry: entry whose stat fields are filled in
+ * Return: true if the file could be stat'ed
+ */
+    bool statOf(const path& filePath, StageEntry& entry) {
+        struct stat st;
+        if (::stat(filePath.c_str(), &st) != 0) return false;
+        entry.size    = st.st_size;
+        entry.mtimeNs = uint64_t(st.st_mtim.tv_sec) * 1000000000ull + st.st_mtim.tv_nsec;
+        entry.inode   = st.st_ino;
+        entry.device  = st.st_dev;
+        return true;
+    }
+/**
+ * statClean - tells whether a cached entry still describes the file on disk
+ * @cached: entry recorded in the stage
+ * @current: freshly stat'ed entry of the file
+ * @indexTime: modification time of the stage file
+ * Return: true if the cached hash can be trusted without re-reading the file
+ *
+ * Entries modified no earlier than the stage itself are racily clean: the file
+ * may have changed again within the same timestamp tick, so they are re-hashed.
+ */
+    bool statClean(const StageEntry& cached, const StageEntry& current, uint64_t indexTime) {
+        return !cached.hash.empty() && cached.size == current.size && cached.mtimeNs == current.mtimeNs
+            && cached.inode == current.inode && cached.device == current.device
+            && cached.mtimeNs < indexTime;
+    }
+/**
+ * writeTree - stores a sorted file list as one tree object per directory
+ * @files: paths and raw blob hashes, sorted by path
+ * Return: hash of the root tree, empty on failure
+ *
+ * Every directory is hashed, but only trees not already stored are written,
+ * so a commit adds objects for the changed directories only.
+ */
+    string writeTree(const vector<pair<string_view, string_view>>& files) {
+        bool stored = true;
+        function<string(size_t, size_t, size_t)> build = [&](size_t begin, size_t end, size_t prefix) {
+            string content;
+            for (size_t i = begin; i < end;) {
+                string_view rest = files[i].first.substr(prefix);
+                size_t slash = rest.find('/');
+                if (slash == string_view::npos) {
+                    content += 'f';
+                    content.append(rest);
+                    content += '\0';
+                    content.append(files[i++].second);
+                    continue;
+                }
+                string_view dir = files[i].first.substr(0, prefix + slash + 1);
+                size_t j = i + 1;
+                while (j < end && files[j].first.compare(0, dir.size(), dir) == 0) ++j;
+                string subtree = build(i, j, dir.size());
+                content += 'd';
+                content.append(rest.substr(0, slash));
+                content += '\0';
+                content += subtree;
+                i = j;
+            }
+            string hash = storeObject(content, "tree");
+            stored = stored && !hash.empty();
+            return rawOf(hash);
+        };
+        string root = build(0, files.size(), 0);
+        return stored ? hexOf(root) : "";
+    }
+/**
+ * readTree - loads and decodes a tree object
+ * @raw: raw hash of the tree, empty for the empty tree
+ * @content: receives the object content, which @entries view into
+ * @entries: receives the children
+ * Return: false if the tree is missing or malformed
+ */
+    bool readTree(string_view raw, string& content, vector<TreeEntry>& entries) {
+        entries.clear();
+        if (raw.empty()) return true;
+        string type;
+        content.clear();
+        bool read = readObject(hexOf(raw), [&](const char* data, size_t len) {
+            content.append(data, len);
+            return true;
+        }, &type);
+        if (!read || type != "tree" || !parseTree(content, hashSize(), entries)) {
+            cerr << "Unable to read the tree " << hexOf(raw) << "\n";
+            return false;
+        }
+        return true;
+    }
+/**
+ * flattenTree - lists every file below a tree in stage order
+ * @raw: raw hash of the tree
+ * @prefix: path of the tree's directory, empty or ending in '/'
+ * @visit: receives each file's path and raw blob hash
+ * Return: false if a tree could not be read
+ */
+    bool flattenTree(string_view raw, const string& prefix, const function<void(const string&, string_view)>& visit) {
+        string content;
+        vector<TreeEntry> entries;
+        if (!readTree(raw, content, entries)) return false;
+        for (const auto& entry : entries) {
+            string name = prefix + string(entry.name);
+            if (entry.dir) {
+                if (!flattenTree(entry.raw, name + "/", visit)) return false;
+            } else {
+                visit(name, entry.raw);
+            }
+        }
+        return true;
+    }
+/**
+ * treeOf - finds the root tree of a commit
+ * @commitID: hash of the commit
+ * Return: hash of the root tree, empty if the commit can't be read
+ *
+ * Commits from before tree objects point at a flat stage snapshot; a tree is
+ * built and stored for those the first time they are asked for.
+ */
+    string treeOf(const string& commitID) {
+        string snapshot = CommitData(commitID).stageSnap;
+        if (snapshot.empty()) return "";
+        auto converted = legacyTrees.find(snapshot);
+        if (converted != legacyTrees.end()) return converted->second;
+
+        string type, prefix;
+        readObject(snapshot, [&](const char* data, size_t len) {
+            prefix.append(data, len);
+            return false;
+        }, &type);
+        if (type == "tree") return snapshot;
+        if (type != "stage") {
+            cerr << "Unable to read the snapshot " << snapshot << "\n";
+            return "";
+        }
+
+        auto flat = stageOf(commitID);
+        vector<pair<string_view, string_view>> files;
+        for (size_t i = 0; i < flat->size(); ++i)
+            files.emplace_back((*flat)[i].path, (*flat)[i].hash);
+        return legacyTrees[snapshot] = writeTree(files);
+    }
+/**
+ * diffTrees - reports the files that differ between two trees
+ * @oldRaw: raw hash of the old tree, empty for none
+ * @newRaw: raw hash of the new tree, empty for none
+ * @prefix: path of the trees' directory, empty or ending in '/'
+ * @change: receives each path with its old and new raw blob hash, empty
+ * where the file is absent
+ * @enter: if set, subtrees whose path (ending in '/') it rejects are skipped
+ * Return: false if a tree could not be read
+ *
+ * Subtrees with equal hashes are skipped without being read.
+ */
+    bool diffTrees(string_view oldRaw, string_view newRaw, const string& prefix,
+                   const function<void(const string&, string_view, string_view)>& change,
+                   const function<bool(const string&)>& enter = nullptr) {
+        if (oldRaw == newRaw) return true;
+        string oldContent, newContent;
+        vector<TreeEntry> before, after;
+        if (!readTree(oldRaw, oldContent, before) || !readTree(newRaw, newContent, after)) return false;
+
+        size_t i = 0, j = 0;
+        while (i < before.size() || j < after.size()) {
+            int order = i == before.size() ? 1 : j == after.size() ? -1 : before[i].key().compare(after[j].key());
+            const TreeEntry* was = order <= 0 ? &before[i++] : nullptr;
+            const TreeEntry* now = order >= 0 ? &after[j++] : nullptr;
+            if (was && now && was->raw == now->raw) continue;
+            string name = prefix + string(was ? was->name : now->name);
+            if ((was && was->dir) || (now && now->dir)) {
+                if (enter && !enter(name + "/")) continue;
+                if (!diffTrees(was ? was->raw : "", now ? now->raw : "", name + "/", change, enter)) return false;
+            } else {
+                change(name, was ? was->raw : "", now ? now->raw : "");
+            }
+        }
+        return true;
+    }
+/**
+ * storeObject - stores in-memory content as an object if it is not already stored
+ * @content: the object content
+ * @type: object type recorded in the object header
+ * @hash: name to store the object under, the hash of @content if empty
+ * Return: hash filename for the object
+ */
+    string storeObject(const string& content, const string& type, string hash = "") {
+        if (hash.empty()) hash = hashOf(content);
+        if (hasObject(hash)) return hash;
+
+        path tempPath = tempFile(repoPath / "objects");
+        ofstream out(tempPath, ios::binary | ios::trunc);
+        bool written;
+        {
+            auto [method, level] = compression();
+            Compressor compressor(out, method, level);
+            string header = type + " " + to_string(content.size()) + '\0';
+            written = compressor.write(header.data(), header.size())
+                   && compressor.write(content.data(), content.size())
+                   && compressor.finish();
+        }
+        out.close();
+        if (!written || !out) {
+            remove(tempPath);
+            return "";
+        }
+        return publishObject(tempPath, hash) ? hash : "";
+    }
+/**
+ * objectPath - locates an object in the fan-out layout
+ * @hash: object hash
+ * Return: path objects/<first 2 hex>/<remaining hex>
+ */
+    path objectPath(const string& hash) {
+        return repoPath / "objects" / hash.substr(0, 2) / hash.substr(2);
+    }
+/**
+ * rawObject - locates an uncompressed copy of a blob
+ * @hash: object hash
+ * Return: path of the raw object (fan-out ".raw" or legacy flat), empty if none
+ */
+    path rawObject(const string& hash) {
+        if (hash.size() <= 2) return {};
+        path raw = objectPath(hash);
+        raw += ".raw";
+        if (exists(raw)) return raw;
+        if (exists(repoPath / "objects" / hash)) return repoPath / "objects" / hash;
+        return {};
+    }
+/**
+ * hasObject - checks whether an object is stored in either layout
+ * @hash: object hash
+ * Return: true if the object exists
+ */
+    bool hasObject(const string& hash) {
+        uint8_t kind;
+        string_view payload;
+        return hash.size() > 2 && (findPacked(hash, kind, payload)
+            || exists(objectPath(hash)) || !rawObject(hash).empty());
+    }
+/**
+ * loadPacks - maps every pack index under objects/pack once per session
+ * Return: the loaded packs
+ */
+    vector<unique_ptr<PackFile>>& loadPacks() {
+        if (packsLoaded) return packs;
+        lock_guard<mutex> guard(loadLock);
+        if (packsLoaded) return packs;
+        error_code ec;
+        for (const auto& entry : directory_iterator(repoPath / "objects" / "pack", ec)) {
+            if (entry.path().extension() != ".idx") continue;
+            auto pack = make_unique<PackFile>(entry.path());
+            if (pack->valid()) packs.push_back(move(pack));
+        }
+        packsLoaded = true;
+        return packs;
+    }
+/**
+ * findPacked - looks an object up in the packs
+ * @hash: object hash
+ * @kind: set to the kind of the pack entry
+ * @payload: set to the entry payload inside the pack mapping
+ * Return: true if a pack holds the object
+ */
+    bool findPacked(const string& hash, uint8_t& kind, string_view& payload) {
+        string raw = rawOf(hash);
+        for (const auto& pack : loadPacks()) {
+            size_t i = pack->find(raw);
+            if (i < pack->size() && pack->entryAt(pack->offsetAt(i), kind, payload))
+                return true;
+        }
+        return false;
+    }
+/**
+ * inflateObject - decompresses a whole compressed object into memory
+ * @payload: compressed "<type> <size>\0content" stream
+ * @content: set to the content after the header
+ * @type: set to the object type, if not nullptr
+ * Return: false if the stream is corrupt
+ */
+    bool inflateObject(string_view payload, string& content, string* type = nullptr) {
+        Decompressor decompressor;
+        string inflated;
+        bool ok = decompressor.feed(payload.data(), payload.size(), [&](const char* data, size_t len) {
+            inflated.append(data, len);
+            return true;
+        }) && decompressor.done();
+        size_t end = inflated.find('\0');
+        if (!ok || end == string::npos) return false;
+        if (type) *type = inflated.substr(0, inflated.find(' '));
+        content = inflated.substr(end + 1);
+        return true;
+    }
+/**
+ * deltaContent - rebuilds a packed object, resolving delta chains
+ * @hash: object hash
+ * @depth: chain depth walked so far
+ * Return: the object content, or nullptr if it cannot be rebuilt
+ *
+ * Rebuilt objects go through the delta-base cache, so walking the versions
+ * of one file only applies one delta per step.
+ */
+    shared_ptr<const string> deltaContent(const string& hash, int depth = 0) {
+        if (auto cached = deltaBases.get(hash)) return cached;
+
+        uint8_t kind;
+        string_view payload;
+        if (depth > 64 || !findPacked(hash, kind, payload)) return nullptr;
+
+        string content;
+        if (kind == packWhole) {
+            if (!inflateObject(payload, content)) return nullptr;
+            return deltaBases.put(hash, move(content));
+        }
+        if (kind != packDelta || payload.size() < hashSize()) return nullptr;
+
+        auto base = deltaContent(hexOf(payload.substr(0, hashSize())), depth + 1);
+        string delta;
+        Decompressor decompressor;
+        payload.remove_prefix(hashSize());
+        if (!base || !decompressor.feed(payload.data(), payload.size(), [&](const char* data, size_t len) {
+                delta.append(data, len);
+                return true;
+            }) || !decompressor.done() || !applyDelta(*base, delta, content))
+            return nullptr;
+        return deltaBases.put(hash, move(content));
+    }
+/**
+ * publishObject - moves a finished temporary object to its fan-out path
+ * @tempPath: the temporary object file
+ * @hash: hash of the object content
+ * @raw: true if the temporary file is an uncompressed blob
+ * Return: true if the object is now stored
+ */
+    bool publishObject(const path& tempPath, const string& hash, bool raw = false) {
+        error_code ec;
+        if (hasObject(hash)) {
+            remove(tempPath, ec);
+            return true;
+        }
+        path target = objectPath(hash);
+        if (raw) target += ".raw";
+        create_directories(target.parent_path(), ec);
+        rename(tempPath, target, ec);
+        if (ec) {
+            remove(tempPath, ec);
+            return false;
+        }
+        Tracer::add(Tracer::objectsWritten, 1);
+        pendingSync(target);
+        return true;
+    }
+/**
+ * readObject - streams the content of an object
+ * @hash: object hash
+ * @sink: receives the content piece by piece, returns false to stop
+ * @type: set to the object type from its header, if not nullptr
+ * @expand: stream a chunked blob's content rather than its manifest
+ * Return: true if the whole object was read
+ *
+ * Packed objects are found through the in-memory pack indexes first;
+ * deltified ones are rebuilt in memory through the delta-base cache.
+ * Compressed objects are inflated on the fly and their header is skipped;
+ * raw objects and those of the legacy flat layout are plain blob copies.
+ * A chunk manifest is read whole and its chunks are streamed in order,
+ * unless @expand is false, in which case the manifest itself is read.
+ */
+    bool readObject(const string& hash, const function<bool(const char*, size_t)>& sink, string* type = nullptr,
+                    bool expand = true) {
+        Decompressor decompressor;
+        bool inHeader = true, chunked = false;
+        string header, manifest;
+        auto skipHeader = [&](const char* data, size_t len) {
+            if (inHeader) {
+                const char* end = static_cast<const char*>(memchr(data, '\0', len));
+                header.append(data, end ? end - data : len);
+                if (!end) return true;
+                inHeader = false;
+                chunked = expand && header.compare(0, header.find(' '), "chunks") == 0;
+                if (type) *type = chunked ? "blob" : header.substr(0, header.find(' '));
+                len -= end + 1 - data;
+                data = end + 1;
+            }
+            if (chunked) {
+                manifest.append(data, len);
+                return true;
+            }
+            return len == 0 || sink(data, len);
+        };
+        auto finish = [&]() {
+            return decompressor.done() && (!chunked || readChunks(manifest, sink));
+        };
+
+        uint8_t kind;
+        string_view payload;
+        if (findPacked(hash, kind, payload)) {
+            if (kind == packWhole)
+                return decompressor.feed(payload.data(), payload.size(), skipHeader) && finish();
+            auto content = deltaContent(hash);
+            if (type) *type = "blob";
+            return content && (content->empty() || sink(content->data(), content->size()));
+        }
+
+        vector<char> buffer(chunkSize);
+        ifstream in(objectPath(hash), ios::binary);
+        Tracer::add(Tracer::filesOpened, 1);
+        if (!in) {
+            path raw = rawObject(hash);
+            ifstream plain(raw, ios::binary);
+            if (raw.empty() || !plain) return false;
+            if (type) *type = "blob";
+            while (plain.read(buffer.data(), buffer.size()) || plain.gcount() > 0)
+                if (!sink(buffer.data(), plain.gcount())) return false;
+            return !plain.bad();
+        }
+
+        while (in.read(buffer.data(), buffer.size()) || in.gcount() > 0)
+            if (!decompressor.feed(buffer.data(), in.gcount(), skipHeader)) return false;
+        return finish();
+    }
+/**
+ * readChunks - streams the chunks listed in a chunk manifest
+ * @manifest: raw chunk hash and varint length per chunk, in file order
+ * @sink: receives the content piece by piece, returns false to stop
+ * Return: true if every chunk was read with its recorded length
+ */
+    bool readChunks(string_view manifest, const function<bool(const char*, size_t)>& sink) {
+        size_t pos = 0;
+        while (pos < manifest.size()) {
+            if (manifest.size() - pos < hashSize()) return false;
+            string chunkHash = hexOf(manifest.substr(pos, hashSize()));
+            pos += hashSize();
+            uint64_t expected, got = 0;
+            if (!getVarint(manifest, pos, expected)) return false;
+            bool read = readObject(chunkHash, [&](const char* data, size_t len) {
+                got += len;
+                return sink(data, len);
+            });
+            if (!read || got != expected) return false;
+        }
+        return true;
+    }
+/**
+ * loadObject - reads a whole object into memory
+ * @hash: object hash
+ * Return: object content, empty if it could not be read
+ */
+    string loadObject(const string& hash) {
+        string content;
+        if (!readObject(hash, [&](const char* data, size_t len) { content.append(data, len); return true; }))
+            return "";
+        return content;
+    }
+/**
+ * setting - reads a value from the repository config
+ * @key: config key
+ * @fallback: value used when the key is not set
+ * Return: the configured value
+ */
+    string setting(const string& key, const string& fallback) {
+        if (!configLoaded) {
+            lock_guard<mutex> guard(loadLock);
+            ifstream in(repoPath / "config");
+            string line;
+            while (!configLoaded && getline(in, line)) {
+                size_t eq = line.find('=');
+                if (eq == string::npos) continue;
+                auto trim = [](string text) {
+                    text.erase(0, text.find_first_not_of(" \t"));
+                    text.erase(text.find_last_not_of(" \t") + 1);
+                    return text;
+                };
+                config[trim(line.substr(0, eq))] = trim(line.substr(eq + 1));
+            }
+            configLoaded = true;
+        }
+        auto it = config.find(key);
+        return it == config.end() ? fallback : it->second;
+    }
+/**
+ * numberSetting - reads an unsigned number from the repository config
+ * @key: config key
+ * @fallback: value used when the key is not set or isn't a number
+ * Return: the configured number
+ *
+ * A malformed value is reported once per key and then ignored.
+ */
+    uint64_t numberSetting(const string& key, uint64_t fallback) {
+        string configured = setting(key, "");
+        uint64_t value;
+        if (configured.empty()) return fallback;
+        if (parseNumber(configured, value)) return value;
+        warnSetting(key, configured, fallback);
+        return fallback;
+    }
+/**
+ * warnSetting - reports a malformed config value, once per key
+ * @key: config key
+ * @configured: the rejected value
+ * @fallback: the default used instead
+ */
+    void warnSetting(const string& key, const string& configured, long long fallback) {
+        static mutex lock;
+        static unordered_set<string> warned;
+        lock_guard<mutex> guard(lock);
+        if (warned.insert(key).second)
+            cerr << "Invalid " << key << " setting - " << configured << ", using " << fallback << "\n";
+    }
+/**
+ * compression - resolves the configured object compression
+ * Return: compression method and level
+ */
+    pair<string, int> compression() {
+        string method = setting("compression", "zlib");
+#ifndef MINIGIT_ZSTD
+        if (method == "zstd") {
+            static atomic<bool> warned{false};
+            if (!warned.exchange(true)) cerr << "zstd support is not built in, using zlib\n";
+            method = "zlib";
+        }
+#endif
+        int level = method == "zstd" ? 3 : Z_DEFAULT_COMPRESSION;
+        string configured = setting("compressionLevel", "");
+        bool negative = !configured.empty() && configured[0] == '-';
+        uint64_t magnitude;
+        if (configured.empty()) {
+            // the method's default level
+        } else if (parseNumber(configured.substr(negative), magnitude) && magnitude <= 100) {
+            level = negative ? -int(magnitude) : int(magnitude);
+        } else {
+            warnSetting("compressionLevel", configured, level);
+        }
+        return { method, level };
+    }
+/**
+ * collectFiles - expands a path spec into repository relative file paths
+ * @spec: a file, a directory, a glob pattern or "-A" for the whole tree
+ * @files: list the matching files are appended to
+ * @scopes: patterns of the walked areas, so vanished files there can be unstaged
+ * @tracked: staged paths, which are collected even if ignored
+ * @single: set to true if the spec named a single existing file
+ * Return: false, with an error printed, if the spec names a path that doesn't exist
+ */
+    bool collectFiles(const string& spec, vector<string>& files, vector<string>& scopes, const StageView& tracked,
+                      bool& single) {
+        single = false;
+        path rootPath = repoPath.parent_path();
+        bool glob = spec.find_first_of("*?[") != string::npos;
+
+        if (spec == "-A" || glob) {
+            walkTree(rootPath, [&](const string& relativePath) {
+                if (!glob || fnmatch(spec.c_str(), relativePath.c_str(), 0) == 0)
+                    files.push_back(relativePath);
+            }, &tracked);
+            scopes.push_back(glob ? spec : "*");
+            return true;
+        }
+
+        path absolutePath = weakly_canonical(rootPath / spec);
+        string relativePath = relative(absolutePath, rootPath).string();
+
+        if (is_directory(absolutePath)) {
+            walkTree(absolutePath, [&](const string& filePath) {
+                files.push_back(relativePath == "." ? filePath : relativePath + "/" + filePath);
+            }, &tracked);
+            scopes.push_back(relativePath == "." ? "*" : relativePath + "/*");
+            return true;
+        }
+
+        if (!exists(absolutePath)) {
+            cerr << "File doesn't exist - " << relativePath << "\n";
+            return false;
+        }
+
+        files.push_back(relativePath);
+        single = true;
+        return true;
+    }
+/**
+ * loadIgnores - reads the .minigitignore patterns once per session
+ */
+    void loadIgnores() {
+        if (ignoresLoaded) return;
+        lock_guard<mutex> guard(loadLock);
+        if (ignoresLoaded) return;
+        ifstream in(repoPath.parent_path() / ".minigitignore");
+        string line;
+        while (getline(in, line)) {
+            line.erase(line.find_last_not_of(" \t\r") + 1);
+            if (!line.empty() && line[0] != '#') ignores.push_back(line);
+        }
+        ignoresLoaded = true;
+    }
+/**
+ * sparsePatterns - reads the sparse-checkout patterns once per session
+ * Return: the patterns, empty when the whole tree is checked out
+ */
+    const SparsePatterns& sparsePatterns() {
+        if (sparseLoaded) return sparse;
+        lock_guard<mutex> guard(loadLock);
+        if (sparseLoaded) return sparse;
+        ifstream in(repoPath / "sparse-checkout");
+        vector<string> patterns;
+        string line;
+        while (getline(in, line)) {
+            line.erase(line.find_last_not_of(" \t\r") + 1);
+            if (!line.empty() && line[0] != '#') patterns.push_back(line);
+        }
+        sparse = SparsePatterns(patterns);
+        sparseLoaded = true;
+        return sparse;
+    }
+/**
+ * ignored - matches a working-tree entry against the .minigitignore patterns
+ * @relativePath: path of the entry relative to the working tree
+ * @isDir: true if the entry is a directory
+ * Return: true if a pattern excludes the entry
+ *
+ * A pattern without a slash matches the entry's name at any depth; one with
+ * a slash matches the whole path from the root. A trailing slash restricts a
+ * pattern to directories. Excluding a directory excludes everything below it.
+ */
+    bool ignored(const string& relativePath, bool isDir) {
+        for (string pattern : ignores) {
+            if (pattern.back() == '/') {
+                if (!isDir) continue;
+                pattern.pop_back();
+            }
+            if (pattern.find('/') == string::npos) {
+                size_t slash = relativePath.rfind('/');
+                const char* name = relativePath.c_str() + (slash == string::npos ? 0 : slash + 1);
+                if (fnmatch(pattern.c_str(), name, 0) == 0) return true;
+            } else {
+                if (pattern[0] == '/') pattern.erase(0, 1);
+                if (fnmatch(pattern.c_str(), relativePath.c_str(), FNM_PATHNAME) == 0) return true;
+            }
+        }
+        return false;
+    }
+/**
+ * walkTree - visits every regular file below a directory, skipping .minigit
+ * @dir: directory to walk
+ * @visit: callback receiving each file path relative to @dir, in sorted order
+ * @tracked: staged paths, if set; ignore patterns don't apply to them
+ *
+ * Directories are read by a worker pool sharing a queue, one open directory
+ * per worker, so outstanding I/O stays bounded by the pool size. Untracked
+ * entries matched by .minigitignore are skipped along with their subtrees;
+ * an ignored directory holding tracked files is still walked.
+ */
+    void walkTree(const path& dir, const function<void(const string&)>& visit, const StageView* tracked = nullptr) {
+        loadIgnores();
+        string base = dir.lexically_relative(repoPath.parent_path()).string();
+        base = base == "." || base.empty() ? "" : base + "/";
+
+        mutex lock;
+        condition_variable wake;
+        deque<pair<string, bool>> pending = { { "", false } };
+        size_t active = 0;
+        vector<string> found;
+
+        auto worker = [&]() {
+            while (true) {
+                unique_lock<mutex> guard(lock);
+                wake.wait(guard, [&] { return !pending.empty() || active == 0; });
+                if (pending.empty()) return;
+                auto [prefix, inIgnored] = move(pending.front());
+                pending.pop_front();
+                ++active;
+                guard.unlock();
+
+                vector<pair<string, bool>> dirs;
+                vector<string> files;
+                if (DIR* handle = opendir((dir / prefix).c_str())) {
+                    while (dirent* entry = readdir(handle)) {
+                        string name = entry->d_name;
+                        if (name == "." || name == ".." || name == ".minigit") continue;
+                        bool isDir = entry->d_type == DT_DIR, isFile = entry->d_type == DT_REG;
+                        if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) {
+                            struct stat st;
+                            bool statted = ::stat((dir / prefix / name).c_str(), &st) == 0;
+                            isFile = statted && S_ISREG(st.st_mode);
+                            isDir = statted && entry->d_type == DT_UNKNOWN && S_ISDIR(st.st_mode);
+                        }
+                        if (!isDir && !isFile) continue;
+                        bool isIgnored = inIgnored || (!ignores.empty() && ignored(base + prefix + name, isDir));
+                        if (isIgnored) {
+                            string relativePath = base + prefix + name;
+                            bool isTracked = tracked && (isDir ? tracked->holdsBelow(relativePath + "/")
+                                                               : tracked->find(relativePath) < tracked->size());
+                            if (!isTracked) continue;
+                        }
+                        if (isDir)
+                            dirs.emplace_back(prefix + name + "/", isIgnored);
+                        else
+                            files.push_back(prefix + name);
+                    }
+                    closedir(handle);
+                }
+
+                guard.lock();
+                for (auto& sub : dirs) pending.push_back(move(sub));
+                found.insert(found.end(), make_move_iterator(files.begin()), make_move_iterator(files.end()));
+                --active;
+                wake.notify_all();
+            }
+        };
+
+        vector<thread> pool;
+        size_t workers = min(16u, max(1u, thread::hardware_concurrency()));
+        for (size_t w = 1; w < workers; ++w)
+            pool.emplace_back(worker);
+        worker();
+        for (auto& t : pool)
+            t.join();
+
+        sort(found.begin(), found.end());
+        for (const string& file : found)
+            visit(file);
+    }
+/**
+ * blob - Stores a file by the hash as a name in the object directory if it is not already stored
+ * @filePath: path to the file to be stored
+ * Return: hash filename for the blob
+ *
+ * The file is read once in fixed-size chunks: every chunk feeds the digest and
+ * a temporary object at the same time, which is renamed to its hash afterwards.
+ * Files of at least bigFileThreshold bytes are stored as raw objects instead,
+ * and files of at least chunkThreshold bytes are split into chunks.
+ */
+    string blob(const path& filePath) {
+        TraceSpan span("blob");
+        path fullPath = repoPath.parent_path() / filePath;
+        ifstream in(fullPath, ios::binary);
+        Tracer::add(Tracer::filesOpened, 1);
+        error_code ec;
+        uintmax_t size = file_size(fullPath, ec);
+        if (!in || ec) return "";
+
+        uint64_t threshold = numberSetting("bigFileThreshold", 0);
+        if (threshold > 0 && size >= threshold) {
+            in.close();
+            return rawBlob(fullPath);
+        }
+        threshold = numberSetting("chunkThreshold", 16 << 20);
+        if (threshold > 0 && size >= threshold)
+            return chunkedBlob(in, size);
+
+        path tempPath = tempFile(repoPath / "objects");
+        ofstream out(tempPath, ios::binary | ios::trunc);
+        if (!out) return "";
+
+        Digest digest(objectHash);
+        bool written;
+        uintmax_t total = 0;
+        {
+            auto [method, level] = compression();
+            Compressor compressor(out, method, level);
+            string header = "blob " + to_string(size) + '\0';
+            written = compressor.write(header.data(), header.size());
+
+            vector<char> buffer(chunkSize);
+            while (written && (in.read(buffer.data(), buffer.size()) || in.gcount() > 0)) {
+                digest.update(buffer.data(), in.gcount());
+                Tracer::add(Tracer::bytesHashed, in.gcount());
+                written = compressor.write(buffer.data(), in.gcount());
+                total += in.gcount();
+            }
+            written = written && compressor.finish();
+        }
+        out.close();
+
+        if (in.bad() || !out || !written || total != size) {
+            remove(tempPath, ec);
+            return "";
+        }
+
+        string blobFile = digest.hex();
+        return publishObject(tempPath, blobFile) ? blobFile : "";
+    }
+/**
+ * chunkedBlob - stores a large file as content-defined chunks plus a manifest
+ * @in: the open file
+ * @size: expected file size
+ * Return: hash of the whole content, empty on failure
+ *
+ * Every chunk is a blob object of its own, so only chunks that were never
+ * seen before are compressed and written. The manifest is stored under the
+ * hash of the whole content, which is what the stage records.
+ */
+    string chunkedBlob(ifstream& in, uintmax_t size) {
+        static const Chunker chunker;
+        Digest digest(objectHash);
+
+        string pending, manifest;
+        vector<char> buffer(4 * Chunker::maxSize);
+        uintmax_t total = 0;
+        bool eof = false, stored = true;
+        while (stored && (!eof || !pending.empty())) {
+            while (!eof && pending.size() < Chunker::maxSize) {
+                in.read(buffer.data(), buffer.size());
+                digest.update(buffer.data(), in.gcount());
+                Tracer::add(Tracer::bytesHashed, in.gcount());
+                pending.append(buffer.data(), in.gcount());
+                total += in.gcount();
+                eof = !in;
+            }
+            size_t start = 0;
+            while (stored && pending.size() - start >= (eof ? 1 : Chunker::maxSize)) {
+                size_t len = chunker.cut(pending.data() + start, pending.size() - start);
+                string chunkHash = storeObject(pending.substr(start, len), "blob");
+                stored = !chunkHash.empty();
+                manifest += rawOf(chunkHash);
+                putVarint(manifest, len);
+                start += len;
+            }
+            pending.erase(0, start);
+        }
+
+        if (!stored || in.bad() || total != size) return "";
+        return storeObject(manifest, "chunks", digest.hex());
+    }
+/**
+ * rawBlob - stores a file as an uncompressed, read-only raw object
+ * @fullPath: path to the file in the working tree
+ * Return: hash of the blob, empty on failure
+ *
+ * The file is hashed, then cloned into the object store, which is a metadata
+ * operation on filesystems with reflinks. The clone is rejected if the file
+ * changed in between.
+ */
+    string rawBlob(const path& fullPath) {
+        StageEntry before, after;
+        if (!statOf(fullPath, before)) return "";
+        string hash = hashOf(fullPath);
+        if (hash.empty()) return "";
+        if (hasObject(hash)) return hash;
+
+        path tempPath = tempFile(repoPath / "objects");
+        if (!cloneFile(fullPath, tempPath, 0444)) return "";
+        error_code ec;
+        if (!statOf(fullPath, after) || after.mtimeNs != before.mtimeNs || after.size != before.size
+            || file_size(tempPath, ec) != before.size) {
+            remove(tempPath, ec);
+            return "";
+        }
+        return publishObject(tempPath, hash, true) ? hash : "";
+    }
+/**
+ * tempFile - builds a unique temporary file name inside a directory
+ * @dir: directory that will hold the temporary file
+ * Return: path of the temporary file (not created yet)
+ */
+    path tempFile(const path& dir) {
+        static atomic<unsigned long> counter{0};
+        return dir / (".tmp-" + to_string(getpid()) + "-" + to_string(counter++));
+    }
+/**
+ * activeBranch - takes the current active branch from HEAD file
+ * Return: name of the current branch
+ */
+    string activeBranch() {
+        return refValue(repoPath / "HEAD");
+    }
+/**
+ * hashOf - Generates the object hash when provided a file path
+ * @filePath: path to the file
+ * Return: hash of the file's contents
+ */
+    string hashOf(const path& filePath) {
+        TraceSpan span("hashOf");
+        ifstream file(filePath, ios::binary);
+        Tracer::add(Tracer::filesOpened, 1);
+        if (!file) return "";
+
+        Digest digest(objectHash);
+        vector<char> buffer(chunkSize);
+        while (file.read(buffer.data(), buffer.size()) || file.gcount() > 0) {
+            digest.update(buffer.data(), file.gcount());
+            Tracer::add(Tracer::bytesHashed, file.gcount());
+        }
+        return digest.hex();
+    }
+/**
+ * hashOf - Generates the object hash from a string provided
+ * @content: input string
+ * Return: hash of the string
+ */
+    string hashOf(const string& content) {
+        Digest digest(objectHash);
+        digest.update(content.data(), content.size());
+        Tracer::add(Tracer::bytesHashed, content.size());
+        return digest.hex();
+    }
+/**
+ * hashSize - number of raw bytes in this repository's object hashes
+ * Return: hash size in bytes
+ */
+    size_t hashSize() const {
+        return digestSize(objectHash);
+    }
+
+/**
+ * latestCommit - fetches the latest commit ID from the currently active branch
+ * Return: latest commit ID 
+ */
+    string latestCommit() {
+        return latestCommit(activeBranch());
+    }
+/**
+ * latestCommit - fetchs latest commit ID of a given branch
+ * @branch: the branch name
+ * Return: latest commit ID for the branch
+ */
+    string latestCommit(const string& branch) {
+        return refValue(repoPath / "refs" / branch);
+    }
+/**
+ * Author - gets the author of a branch
+ * @branch: name of the branch
+ * Return: author's name as string
+ */
+    string Author(const string& branch) {
+        return refValue(repoPath / "authors" / branch);
+    }
+/**
+ * commitString - converts the commit node to strings
+ * @node: the commit node structure
+ * Return: string of the commit content
+ */
+    string commitString(const CommitNode& node) {
+        string commit;
+        commit += "stageSnapshot: " + node.stageSnap + "\n";
+        commit += "prevCommit: "    + node.prevCommit + "\n";
+        commit += "timestamp: "     + node.timestamp + "\n";
+        commit += "author: "        + node.author    + "\n";
+        commit += "comment: "       + node.comment   + "\n";
+        return commit;
+    }
+
+/**
+ * findHash - resolves a reference (branch or commit ID) into a valid commit hash
+ * @targetName: the name of branch or commit ID
+ * Return: resolved commit hash 
+ */
+    string findHash(const string& targetName) {
+        bool isBranch;
+        string commitID = refValue(repoPath / "refs" / targetName, &isBranch);
+        if (isBranch) return commitID;
+    
+        if (hasCommit(targetName)) return targetName;
+    
+        cerr << "reference - " << targetName << " doesn't exist\n";
+        return "";
+    }
+/**
+ * recover - Restores files when provided a given commit ID
+ * @commitID: ID of the commit to recover from
+ * @fromCommit: commit the working tree currently holds, empty if unknown
+ *
+ * Return: false if nothing was written
+ *
+ * Nothing is written if a file to be replaced or deleted has local edits.
+ */
+    bool recover(const string& commitID, const string& fromCommit = "") {
+        TraceSpan span("recover");
+        vector<pair<string, string>> changes;
+        if (!recoverChanges(commitID, fromCommit, changes) || clobbersLocalEdits(changes, "checkout")) return false;
+        applyChanges(changes);
+        cout << "Files are restored successfully from commit - " << commitID << "\n";
+        return true;
+    }
+/**
+ * recoverChanges - lists the working-tree changes that bring a commit in
+ * @commitID: ID of the commit to recover from
+ * @fromCommit: commit the working tree currently holds, empty if unknown
+ * @changes: receives paths with the raw hash of their new blob, empty to delete
+ * Return: false if a tree could not be read
+ *
+ * Without a @fromCommit every file is listed. Otherwise only the files that
+ * differ between the two trees are, and subtrees shared by both are skipped
+ * without being read, as are subtrees outside a sparse checkout.
+ */
+    bool recoverChanges(const string& commitID, const string& fromCommit, vector<pair<string, string>>& changes) {
+        string tree = treeOf(commitID);
+        if (tree.empty()) {
+            cerr << "no stage found for the commit - " << commitID << "\n";
+            return false;
+        }
+        string fromTree = fromCommit.empty() ? "" : treeOf(fromCommit);
+        const SparsePatterns& patterns = sparsePatterns();
+        bool read = diffTrees(rawOf(fromTree), rawOf(tree), "", [&](const string& file, string_view, string_view raw) {
+            if (patterns.matches(file)) changes.emplace_back(file, string(raw));
+        }, patterns.empty() ? nullptr : function<bool(const string&)>([&](const string& dir) {
+            return patterns.enters(dir);
+        }));
+        return read;
+    }
+/**
+ * currentIndex - maps what the working tree is compared against
+ * @indexTime: set to the stage file's modification time in nanoseconds
+ * Return: the branch's stage, or the commit's snapshot on a detached HEAD
+ */
+    shared_ptr<const StageView> currentIndex(uint64_t& indexTime) {
+        string branch = activeBranch();
+        indexTime = 0;
+        bool onBranch;
+        refValue(repoPath / "refs" / branch, &onBranch);
+        if (onBranch) return indexOf(branch, indexTime);
+        return hasCommit(branch) ? stageOf(branch) : make_shared<const StageView>();
+    }
+/**
+ * stagedChanges - lists the paths whose stage differs from the branch's tip
+ * @branch: the branch
+ * Return: paths that are staged but not committed, sorted
+ */
+    vector<string> stagedChanges(const string& branch) {
+        uint64_t indexTime;
+        auto index = indexOf(branch, indexTime);
+        string tip = latestCommit(branch);
+        auto committed = tip.empty() ? make_shared<const StageView>() : stageOf(tip);
+        vector<string> paths;
+        joinStages({ index.get(), committed.get() }, [&](string_view file, const vector<size_t>& at) {
+            bool staged = at[0] < index->size(), tracked = at[1] < committed->size();
+            if (!staged || !tracked || (*index)[at[0]].hash != (*committed)[at[1]].hash)
+                paths.emplace_back(file);
+        });
+        return paths;
+    }
+/**
+ * clobbersLocalEdits - checks that changes won't overwrite local edits
+ * @changes: paths with the raw hash they are about to get, empty to delete
+ * @action: the command, for the error message
+ * Return: true, with the files listed on cerr, if any would be lost
+ *
+ * A working-tree file is safe to touch when its stat data or content
+ * matches the stage, or it already holds the new content. Files are checked
+ * in parallel and only hashed when their stat data doesn't match.
+ */
+    bool clobbersLocalEdits(const vector<pair<string, string>>& changes, const string& action) {
+        uint64_t indexTime;
+        auto index = currentIndex(indexTime);
+        path workTree = repoPath.parent_path();
+        vector<uint8_t> dirty(changes.size(), 0);
+        parallelFor(changes.size(), [&](size_t k) {
+            const auto& [file, raw] = changes[k];
+            StageEntry current;
+            if (!statOf(workTree / file, current)) return;
+            size_t i = index->find(file);
+            bool tracked = i < index->size();
+            if (tracked && statClean(index->statAt(i), current, indexTime)) return;
+            string hash = hashOf(workTree / file);
+            if ((tracked && hash == hexOf((*index)[i].hash)) || (!raw.empty() && hash == hexOf(raw))) return;
+            dirty[k] = 1;
+        });
+        if (find(dirty.begin(), dirty.end(), 1) == dirty.end()) return false;
+
+        cerr << "Your local changes to these files would be overwritten by " << action << ":\n";
+        for (size_t k = 0; k < changes.size(); ++k)
+            if (dirty[k]) cerr << "    " << changes[k].first << "\n";
+        cerr << "Commit or stage them, then try again\n";
+        return true;
+    }
+/**
+ * applyChanges - writes and deletes working-tree files
+ * @changes: paths with the raw hash of their new blob, empty to delete
+ * @forced: if set, paths it accepts are written even outside a sparse checkout
+ *
+ * Deletions go first, pruning the directories they leave empty, so a file
+ * may be replaced by a directory of the same name. Writes then run across a
+ * worker pool. Raw objects are cloned into place, or hardlinked read-only
+ * when the checkout setting is "hardlink". Files outside a sparse checkout
+ * are neither read from the object store nor written.
+ */
+    void applyChanges(const vector<pair<string, string>>& changes,
+                      const function<bool(const string&)>& forced = nullptr) {
+        path workTree = repoPath.parent_path();
+        const SparsePatterns& patterns = sparsePatterns();
+        vector<const pair<string, string>*> writes;
+        size_t removed = 0;
+        for (const auto& change : changes) {
+            if (!change.second.empty()) {
+                if (patterns.matches(change.first) || (forced && forced(change.first)))
+                    writes.push_back(&change);
+                continue;
+            }
+            path fullPath = workTree / change.first;
+            error_code ec;
+            remove(fullPath, ec);
+            for (path dir = fullPath.parent_path(); dir != workTree && !dir.empty(); dir = dir.parent_path())
+                if (!remove(dir, ec)) break;
+            ++removed;
+        }
+
+        bool hardlink = setting("checkout", "copy") == "hardlink";
+        mutex errorLock;
+        atomic<size_t> failed{0};
+        parallelFor(writes.size(), [&](size_t k) {
+            const auto& [file, rawHash] = *writes[k];
+            string blobHash = hexOf(rawHash);
+            path fullPath = workTree / file;
+
+            error_code ec;
+            create_directories(fullPath.parent_path(), ec);
+            remove(fullPath, ec);
+
+            bool restored = false;
+            path raw = rawObject(blobHash);
+            if (!raw.empty()) {
+                if (hardlink) create_hard_link(raw, fullPath, ec);
+                restored = (hardlink && !ec) || cloneFile(raw, fullPath, 0666);
+            } else {
+                ofstream rStream(fullPath, ios::binary | ios::trunc);
+                Tracer::add(Tracer::filesOpened, 1);
+                restored = rStream && readObject(blobHash, [&](const char* data, size_t len) {
+                    Tracer::add(Tracer::bytesCopied, len);
+                    return bool(rStream.write(data, len));
+                });
+                rStream.close();
+            }
+            if (!restored) {
+                ++failed;
+                lock_guard<mutex> guard(errorLock);
+                cerr << "Unable to restore " << file << " from object " << blobHash << "\n";
+            }
+        });
+
+        cout << writes.size() - failed << " written, " << removed << " removed\n";
+    }
+
+/**
+ * stageOf - lists every file of a commit ID
+ * @commitID: hash of the commit
+ * Return: view of the commit's files and their hashes, sorted by path
+ *
+ * Tree objects are flattened; older commits hold a flat stage snapshot that
+ * is mapped as-is. Either way the result is immutable, so it is kept in a
+ * session cache.
+ */
+    shared_ptr<const StageView> stageOf(const string& commitID) {
+        TraceSpan span("stageOf");
+        string stageHash = CommitData(commitID).stageSnap;
+        if (auto cached = snapshotCache.get(stageHash)) return cached;
+        string content, type;
+        readObject(stageHash, [&](const char* data, size_t len) {
+            content.append(data, len);
+            return true;
+        }, &type);
+        if (type == "tree") {
+            StageWriter writer;
+            bool read = flattenTree(rawOf(stageHash), "", [&](const string& file, string_view raw) {
+                writer.add(file, raw);
+            });
+            content = read ? writer.finish() : "";
+        }
+        StageView snapshot(move(content));
+        if (snapshot.empty()) return make_shared<const StageView>();
+        return snapshotCache.put(stageHash, move(snapshot));
+    }
+
+/**
+ * commitText - reads the raw text of a commit, loose or packed
+ * @id: the commit hash
+ * Return: commit text, empty if the commit doesn't exist
+ */
+    string commitText(const string& id) {
+        ifstream file(repoPath / "commits" / id, ios::binary);
+        if (file) {
+            stringstream buffer;
+            buffer << file.rdbuf();
+            return buffer.str();
+        }
+
+        string text, type;
+        if (id.empty() || !readObject(id, [&](const char* data, size_t len) { text.append(data, len); return true; }, &type)
+            || type != "commit")
+            return "";
+        return text;
+    }
+/**
+ * hasCommit - checks whether a commit exists, loose or packed
+ * @id: the commit hash
+ * Return: true if the commit exists
+ */
+    bool hasCommit(const string& id) {
+        uint8_t kind;
+        string_view payload;
+        return !id.empty() && (exists(repoPath / "commits" / id) || findPacked(id, kind, payload));
+    }
+
+/**
+ * CommitData - Loads commit details from a commit ID
+ * @id: the commit hash
+ * Return: CommitNode struct with data
+ *
+ * Commits are content-addressed, so parsed ones are kept in a session cache.
+ */
+    CommitNode CommitData(const string& id) {
+        TraceSpan span("CommitData");
+        if (auto cached = commitCache.get(id)) return *cached;
+        CommitNode node;
+        node.id = id;
+    
+        string text = commitText(id);
+        if (text.empty()) {
+            cerr << "Unable to load the commit - " << id << "\n";
+            return node;
+        }
+        istringstream file(text);
+    
+        string line;
+        getline(file, line);
+        node.stageSnap = line.substr(string("stageSnapshot: ").size());
+    
+        getline(file, line);
+        node.prevCommit = line.substr(string("prevCommit: ").size());
+    
+        getline(file, line);
+        node.timestamp = line.substr(string("timestamp: ").size());
+    
+        getline(file, line);
+        node.author = line.substr(string("author: ").size());
+    
+        getline(file, line);
+        node.comment = line.substr(string("comment: ").size());
+    
+        commitCache.put(id, node);
+        return node;
+    }
+
+/**
+ * time - Gets the current time as string
+ * Return: timestamp string
+ */
+    string time() {
+    time_t now = chrono::system_clock::to_time_t(chrono::system_clock::now());
+    string t = ctime(&now);
+    t.pop_back();
+    return t;
+}
+
+/**
+ * commonAncestor - finds the best common ancestor between two commits
+ * @commitA: first commit hash
+ * @commitB: second commit hash
+ * Return: common ancestor commit hash 
+ *
+ * Both sides are painted in one walk over the commit graph, always taking the
+ * commit with the highest generation next. Every descendant of a common
+ * ancestor has a higher generation and is visited first, so the first commit
+ * found painted by both sides is a best merge base and the walk stops there.
+ */
+    string commonAncestor(const string& commitA, const string& commitB) {
+        TraceSpan span("commonAncestor");
+        uint32_t a = graphPosition(commitA), b = graphPosition(commitB);
+        if (a == noCommit || b == noCommit) return "";
+        if (a == b) return commitA;
+
+        enum : uint8_t { sideA = 1, sideB = 2 };
+        unordered_map<uint32_t, uint8_t> flags;
+        auto byGeneration = [&](uint32_t x, uint32_t y) {
+            return graph[x].generation != graph[y].generation ? graph[x].generation < graph[y].generation : x < y;
+        };
+        priority_queue<uint32_t, vector<uint32_t>, decltype(byGeneration)> lineage(byGeneration);
+        flags[a] = sideA;
+        flags[b] = sideB;
+        lineage.push(a);
+        lineage.push(b);
+
+        while (!lineage.empty()) {
+            uint32_t position = lineage.top();
+            lineage.pop();
+            uint8_t flag = flags[position];
+            if (flag == (sideA | sideB))
+                return hexOf(graph[position].raw);
+
+            for (uint32_t parent : graph[position].parents) {
+                if (parent == noCommit || (flags[parent] & flag) == flag) continue;
+                flags[parent] |= flag;
+                lineage.push(parent);
+            }
+        }
+        return "";
+    }
+
+/**
+ * loadGraph - reads the commit-graph file once per session
+ *
+ * The file is "CGPH", u32 version, u32 hash length, followed by one record
+ * per commit in the order commits were added: raw hash, u32 positions of up
+ * to two parents (0xffffffff for none) and a u32 generation number, one more
+ * than the highest parent generation. A torn trailing record is ignored.
+ */
+    void loadGraph() {
+        if (graphLoaded) return;
+        graphLoaded = true;
+
+        MappedFile file(repoPath / "commit-graph");
+        graphBytes = file.size();
+        if (file.size() < graphHeaderSize || memcmp(file.data(), graphMagic, 4) != 0) return;
+        size_t hashLen = hashSize(), recordSize = hashLen + graphRecordExtra;
+        size_t records = (file.size() - graphHeaderSize) / recordSize;
+        graph.reserve(records);
+        for (size_t i = 0; i < records; ++i) {
+            const char* record = file.data() + graphHeaderSize + i * recordSize;
+            GraphNode node;
+            node.raw.assign(record, hashLen);
+            memcpy(node.parents, record + hashLen, 8);
+            memcpy(&node.generation, record + hashLen + 8, 4);
+            graphIndex.emplace(node.raw, graph.size());
+            graph.push_back(move(node));
+        }
+    }
+
+/**
+ * graphPosition - finds a commit in the commit graph, adding it if needed
+ * @id: the commit hash
+ * Return: position of the commit in the graph, or noCommit if it doesn't exist
+ *
+ * Commits missing from the graph, such as those made before it existed, are
+ * added together with their missing ancestors, parents first. Appends hold
+ * an exclusive flock on the file; if another process appended since the
+ * graph was loaded, it is reloaded first so positions stay consistent.
+ */
+    uint32_t graphPosition(const string& id) {
+        loadGraph();
+        auto known = graphIndex.find(rawOf(id));
+        if (known != graphIndex.end()) return known->second;
+        if (!hasCommit(id)) return noCommit;
+
+        path graphPath = repoPath / "commit-graph";
+        int fd = ::open(graphPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+        struct stat graphStat {};
+        bool locked = fd >= 0 && ::flock(fd, LOCK_EX) == 0 && ::fstat(fd, &graphStat) == 0;
+        if (locked && size_t(graphStat.st_size) != graphBytes) {
+            graph.clear();
+            graphIndex.clear();
+            graphLoaded = false;
+            loadGraph();
+            known = graphIndex.find(rawOf(id));
+            if (known != graphIndex.end()) {
+                ::close(fd);
+                return known->second;
+            }
+        }
+
+        string appended;
+        vector<pair<string, bool>> pending = { { id, false } };
+        while (!pending.empty()) {
+            auto [commitID, expanded] = pending.back();
+            string raw = rawOf(commitID);
+            if (graphIndex.count(raw)) {
+                pending.pop_back();
+                continue;
+            }
+
+            vector<string> parents;
+            istringstream parentStream(CommitData(commitID).prevCommit);
+            string parent;
+            while (getline(parentStream, parent, ','))
+                if (!parent.empty() && hasCommit(parent)) parents.push_back(parent);
+
+            if (!expanded) {
+                pending.back().second = true;
+                for (const string& p : parents)
+                    if (!graphIndex.count(rawOf(p))) pending.push_back({ p, false });
+                continue;
+            }
+            pending.pop_back();
+
+            GraphNode node;
+            node.raw = raw;
+            node.parents[0] = node.parents[1] = noCommit;
+            node.generation = 1;
+            for (size_t i = 0; i < parents.size() && i < 2; ++i) {
+                node.parents[i] = graphIndex.at(rawOf(parents[i]));
+                node.generation = max(node.generation, graph[node.parents[i]].generation + 1);
+            }
+            appended += node.raw;
+            appended.append(reinterpret_cast<const char*>(node.parents), 8);
+            appended.append(reinterpret_cast<const char*>(&node.generation), 4);
+            graphIndex.emplace(raw, graph.size());
+            graph.push_back(move(node));
+        }
+
+        if (locked) {
+            size_t existing = graphStat.st_size;
+            size_t recordSize = hashSize() + graphRecordExtra;
+            if (existing < graphHeaderSize) {
+                uint32_t hashLen = hashSize();
+                string header(graphMagic, 4);
+                header.append(reinterpret_cast<const char*>(&graphVersion), 4);
+                header.append(reinterpret_cast<const char*>(&hashLen), 4);
+                appended.insert(0, header);
+                existing = 0;
+            } else {
+                existing -= (existing - graphHeaderSize) % recordSize;
+            }
+            if (::ftruncate(fd, existing) == 0 && ::lseek(fd, existing, SEEK_SET) >= 0
+                && writeAll(fd, appended.data(), appended.size()))
+                graphBytes = existing + appended.size();
+        }
+        if (fd >= 0) ::close(fd);
+        return graphIndex.at(rawOf(id));
+    }
+
+/**
+ * loadPathFilters - reads the changed-path filters file
+ *
+ * The file is "CPBF", u32 version, u32 hash length, followed by one record
+ * per commit: raw hash, u32 filter size and the filter bytes, which hold the
+ * paths changed against the first parent. A torn trailing record is ignored.
+ */
+    void loadPathFilters() {
+        if (pathFiltersLoaded) return;
+        pathFiltersLoaded = true;
+        pathFilterBytes = 0;
+
+        MappedFile file(repoPath / "changed-paths");
+        uint32_t hashLen = 0;
+        if (file.size() < filterHeaderSize || memcmp(file.data(), filterMagic, 4) != 0) return;
+        memcpy(&hashLen, file.data() + 8, 4);
+        if (hashLen != hashSize()) return;
+        size_t pos = filterHeaderSize;
+        while (pos + hashLen + 4 <= file.size()) {
+            uint32_t len;
+            memcpy(&len, file.data() + pos + hashLen, 4);
+            if (pos + hashLen + 4 + len > file.size()) break;
+            pathFilters.emplace(string(file.data() + pos, hashLen), string(file.data() + pos + hashLen + 4, len));
+            pos += hashLen + 4 + len;
+        }
+        pathFilterBytes = pos;
+    }
+/**
+ * pathFilter - gets the changed-path filter of a commit, computing it if needed
+ * @position: the commit's position in the commit graph
+ * Return: the filter bytes
+ *
+ * Filters are computed by diffing the commit's tree with its first parent's
+ * and queued for savePathFilters. A commit whose trees can't be read gets a
+ * filter matching everything for this session only.
+ */
+    const string& pathFilter(uint32_t position) {
+        loadPathFilters();
+        string raw = graph[position].raw;
+        auto known = pathFilters.find(raw);
+        if (known != pathFilters.end()) return known->second;
+
+        uint32_t parent = graph[position].parents[0];
+        string before = parent == noCommit ? "" : treeOf(hexOf(graph[parent].raw));
+        string after = treeOf(hexOf(raw));
+        vector<string> files;
+        bool read = !after.empty() && (parent == noCommit || !before.empty())
+                 && diffTrees(rawOf(before), rawOf(after), "", [&](const string& file, string_view, string_view) {
+                        files.push_back(file);
+                    });
+        if (!read) return pathFilters[raw] = string(1, '\xff');
+
+        string filter = buildPathFilter(files);
+        uint32_t len = filter.size();
+        pendingFilters += raw;
+        pendingFilters.append(reinterpret_cast<const char*>(&len), 4);
+        pendingFilters += filter;
+        return pathFilters[raw] = move(filter);
+    }
+/**
+ * savePathFilters - appends the filters computed in this session to the file
+ *
+ * Appends hold an exclusive flock; the file is reread first if another
+ * process appended since it was loaded, and a torn tail is cut off.
+ */
+    void savePathFilters() {
+        if (pendingFilters.empty()) return;
+        path filterPath = repoPath / "changed-paths";
+        int fd = ::open(filterPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+        struct stat filterStat {};
+        if (fd < 0 || ::flock(fd, LOCK_EX) != 0 || ::fstat(fd, &filterStat) != 0) {
+            if (fd >= 0) ::close(fd);
+            return;
+        }
+        if (size_t(filterStat.st_size) != pathFilterBytes) {
+            pathFiltersLoaded = false;
+            loadPathFilters();
+        }
+
+        string appended;
+        appended.swap(pendingFilters);
+        size_t existing = pathFilterBytes;
+        if (existing < filterHeaderSize) {
+            uint32_t hashLen = hashSize();
+            string header(filterMagic, 4);
+            header.append(reinterpret_cast<const char*>(&filterVersion), 4);
+            header.append(reinterpret_cast<const char*>(&hashLen), 4);
+            appended.insert(0, header);
+            existing = 0;
+        }
+        if (::ftruncate(fd, existing) == 0 && ::lseek(fd, existing, SEEK_SET) >= 0
+            && writeAll(fd, appended.data(), appended.size()))
+            pathFilterBytes = existing + appended.size();
+        ::close(fd);
+    }
+/**
+ * recordCommit - adds a new commit to the commit graph and the path filters
+ * @id: the commit hash
+ */
+    void recordCommit(const string& id) {
+        uint32_t position = graphPosition(id);
+        if (position == noCommit) return;
+        pathFilter(position);
+        savePathFilters();
+    }
+/**
+ * treeEntry - finds a file or directory inside a tree
+ * @root: raw hash of the root tree, empty for the empty tree
+ * @path: slash-separated path of the entry
+ * Return: raw hash of the entry, empty if it doesn't exist
+ */
+    string treeEntry(string_view root, string_view path) {
+        string raw(root), content;
+        vector<TreeEntry> entries;
+        while (!raw.empty()) {
+            size_t slash = path.find('/');
+            string_view name = path.substr(0, slash);
+            if (!readTree(raw, content, entries)) return "";
+            raw.clear();
+            for (const auto& entry : entries)
+                if (entry.name == name && (entry.dir || slash == string_view::npos)) {
+                    raw = entry.raw;
+                    break;
+                }
+            if (slash == string_view::npos) return raw;
+            path.remove_prefix(slash + 1);
+        }
+        return "";
+    }
+
+
+public:
+
+/**
+ * MinGit - Constructor for the MinGit object
+ * @path: the absolute path of the repository
+ * @author: author name for master branch
+ */
+    MinGit(const string& path, const string& author) {
+        repoPath = path + "/.minigit";
+        repoName = repoPath.parent_path().filename().string();
+        this->author = author;
+        hashName = setting("hash", "sha1");
+        hashKnown = hashAlgorithmOf(hashName, objectHash);
+    }
+
+/**
+ * hashSupported - checks that this build can hash objects like the repository
+ * Return: false if the configured hash isn't available, with an error printed
+ *
+ * Commands must not touch objects otherwise: falling back to another hash
+ * would mix hash lengths in stages and trees.
+ */
+    bool hashSupported() {
+        if (!hashKnown)
+            cerr << "Unsupported object hash " << hashName << " in the config, this build can't use the repository\n";
+        return hashKnown;
+    }
+
+/**
+ * syncWrites - makes everything written so far durable, as one batch
+ *
+ * Queued files are fsync'ed together across the worker pool, so the
+ * filesystem can commit them in a single journal transaction, followed by
+ * the directories holding them. The fsync setting "false" turns this off.
+ */
+    void syncWrites() {
+        vector<path> files;
+        unordered_set<string> dirs;
+        {
+            lock_guard<mutex> guard(syncLock);
+            files.swap(unsyncedFiles);
+            dirs.swap(unsyncedDirs);
+        }
+        if (files.empty() && dirs.empty()) return;
+        if (setting("fsync", "true") == "false") return;
+        auto syncPath = [](const string& file, int flags) {
+            int fd = ::open(file.c_str(), flags | O_CLOEXEC);
+            if (fd < 0) return;
+            ::fsync(fd);
+            ::close(fd);
+        };
+        parallelFor(files.size(), [&](size_t i) { syncPath(files[i].string(), O_RDONLY); });
+        for (const string& dir : dirs)
+            syncPath(dir, O_RDONLY | O_DIRECTORY);
+    }
+
+/**
+ * init - Initializes .MiniGit repository if not already present
+ * @hash: object hash algorithm, "sha1", "sha256" or "blake3"
+ *
+ * The algorithm is recorded in the config and fixed for the repository's life.
+ */
+      void init(const string& hash = "sha1") {
+        if (exists(repoPath)) {
+            cout << "It is already initialized\n";
+            return;
+        }
+        if (!hashAlgorithmOf(hash, objectHash)) {
+            cerr << "Unsupported object hash - " << hash << "\n";
+            return;
+        }
+        hashName = hash;
+        hashKnown = true;
+
+        create_directory(repoPath);
+        create_directory(repoPath / "objects");
+        create_directory(repoPath / "refs");
+        create_directory(repoPath / "commits");
+        create_directory(repoPath / "stages");
+        create_directory(repoPath / "authors");
+
+        writeRef(repoPath / "HEAD", "master");
+
+        writeFile(repoPath / "config", "compression = zlib\nhash = " + hash + "\n");
+        configLoaded = false;
+        config.clear();
+
+        branch("master", author);
+        cout << repoName << " is initialized successfully\n";
+    }
+
+/**
+ * add - stages files for commit by recording their blob hashes
+ * @pathSpecs: files, directories, glob patterns or "-A" for the whole tree
+ *
+ * Files are hashed and blobbed on a worker pool, merged into the stage in
+ * memory and the stage file is written once at the end. The stage stays
+ * locked meanwhile, so concurrent adds to one branch can't lose entries.
+ * Nothing is staged if a spec names a path that doesn't exist.
+ */
+    void add(const vector<string>& pathSpecs) {
+        string branch = activeBranch();
+        path stagePath = repoPath / "stages" / branch;
+        LockFile stageLock(stagePath);
+        if (!stageLock) {
+            cerr << "The stage of " << branch << " is locked by another process\n";
+            return;
+        }
+
+        uint64_t indexTime;
+        auto index = indexOf(branch, indexTime);
+        const StageView& stage = *index;
+
+        vector<string> files, scopes;
+        bool bulk = pathSpecs.size() > 1;
+        for (const string& spec : pathSpecs) {
+            bool single;
+            if (!collectFiles(spec, files, scopes, stage, single)) return;
+            bulk |= !single;
+        }
+
+        sort(files.begin(), files.end());
+        files.erase(unique(files.begin(), files.end()), files.end());
+
+        size_t staged = 0, restaged = 0, unchanged = 0, removed = 0;
+
+        vector<StageEntry> entries(files.size());
+        vector<size_t> found(files.size());
+        parallelFor(files.size(), [&](size_t i) {
+            path fullPath = repoPath.parent_path() / files[i];
+            found[i] = stage.find(files[i]);
+            if (!statOf(fullPath, entries[i])) return;
+
+            if (found[i] < stage.size() && statClean(stage.statAt(found[i]), entries[i], indexTime))
+                entries[i].hash = hexOf(stage[found[i]].hash);
+            else
+                entries[i].hash = blob(fullPath);
+        });
+
+        bool dirty = false;
+        vector<string> raws(files.size());
+        for (size_t i = 0; i < files.size(); ++i) {
+            const string& relativePath = files[i];
+            if (entries[i].hash.empty()) {
+                cerr << "blobbing failed - " << relativePath << "\n";
+                continue;
+            }
+            string raw = rawOf(entries[i].hash);
+            bool alreadyStaged = found[i] < stage.size();
+            if (alreadyStaged && stage[found[i]].hash == raw) {
+                if (!bulk) cout << "File is already staged - " << relativePath << "\n";
+                StageEntry cached = stage.statAt(found[i]);
+                dirty |= cached.mtimeNs != entries[i].mtimeNs || cached.size != entries[i].size
+                      || cached.inode != entries[i].inode || cached.device != entries[i].device
+                      || cached.mtimeNs >= indexTime;
+                ++unchanged;
+                continue;
+            }
+            raws[i] = move(raw);
+            dirty = true;
+
+            if (alreadyStaged) {
+                if (!bulk) cout << "File is restaged with new content - " << relativePath << "\n";
+                ++restaged;
+            } else {
+                if (!bulk) cout << "File is staged - " << relativePath << "\n";
+                ++staged;
+            }
+        }
+
+        StageWriter writer;
+        for (size_t k = 0, i = 0; k < stage.size() || i < files.size();) {
+            int order = k == stage.size() ? 1 : i == files.size() ? -1 : stage[k].path.compare(files[i]);
+            if (order > 0) {
+                if (!raws[i].empty()) writer.add(files[i], raws[i], &entries[i]);
+                ++i;
+                continue;
+            }
+            string_view file = stage[k].path;
+            if (order == 0 && !raws[i].empty()) {
+                writer.add(file, raws[i], &entries[i]);
+            } else if (order == 0 && !entries[i].hash.empty()) {
+                writer.add(file, stage[k].hash, &entries[i]);
+            } else if (order < 0 && sparsePatterns().matches(file)
+                       && any_of(scopes.begin(), scopes.end(), [&](const string& scope) {
+                              return fnmatch(scope.c_str(), string(file).c_str(), 0) == 0;
+                          })) {
+                ++removed;
+            } else {
+                StageEntry stat = stage.statAt(k);
+                writer.add(file, stage[k].hash, &stat);
+            }
+            i += order == 0;
+            ++k;
+        }
+
+        if (dirty || removed > 0 || !exists(stagePath)) {
+            if (stageLock.write(writer.finish()) && stageLock.commit())
+                pendingSync(stagePath);
+            else
+                cerr << "Unable to write the stage of " << branch << "\n";
+        }
+
+        if (bulk)
+            cout << staged << " staged, " << restaged << " restaged, "
+                 << unchanged << " already staged, " << removed << " removed\n";
+    }
+
+/**
+ * commit - creates a new commit using the staged files
+ * @comment: commit message to describe the changes
+ */
+    void commit(const string& comment) {
+        string branch = activeBranch();
+
+        uint64_t indexTime;
+        auto index = indexOf(branch, indexTime);
+        if (index->empty()) {
+            cerr << "No changes to commit — stage is empty\n";
+            return;
+        }
+
+        vector<pair<string_view, string_view>> staged;
+        staged.reserve(index->size());
+        for (size_t i = 0; i < index->size(); ++i)
+            staged.emplace_back((*index)[i].path, (*index)[i].hash);
+        string snapBlob = writeTree(staged);
+        if (snapBlob.empty()) {
+            cerr << "Unable to snapshot the stage\n";
+            return;
+        }
+
+        string lastCommit   = latestCommit();
+        path mergeHead = repoPath / "MERGE_HEAD";
+        string mergeParent = refValue(mergeHead);
+        if (!mergeParent.empty()) {
+            ifstream in(mergeHead);
+            string line, into;
+            getline(in, line);
+            getline(in, into);
+            if (!into.empty() && into != branch) {
+                cerr << "A merge into " << into << " is in progress, check it out to finish it\n";
+                return;
+            }
+        }
+        if (mergeParent.empty() && !lastCommit.empty() && treeOf(lastCommit) == snapBlob) {
+            cerr << "No changes to commit — stage matches the latest commit\n";
+            return;
+        }
+
+        string timestamp    = time();
+        string branchAuthor = Author(branch);
+
+        CommitNode node;
+        node.stageSnap  = snapBlob;
+        node.prevCommit = mergeParent.empty() ? lastCommit : lastCommit + "," + mergeParent;
+        node.timestamp  = timestamp;
+        node.author     = branchAuthor;
+        node.comment    = comment;
+
+        string commit = commitString(node);
+        string commitHash = hashOf(commit);
+
+        if (!writeFile(repoPath / "commits" / commitHash, commit)
+            || !writeRef(repoPath / "refs" / branch, commitHash, &lastCommit))
+            return;
+        recordCommit(commitHash);
+        if (!mergeParent.empty()) remove(mergeHead);
+
+        cout << "commit @" << commitHash << " - " << comment << "\n";
+    }
+
+/**
+ * log - displays the commit chain history for the current branch
+ * @pathSpec: only list commits that changed this file or directory, if not empty
+ *
+ * With a path, the first-parent chain is walked through the commit graph and
+ * each commit's changed-path filter; only commits the filter can't rule out
+ * have the path looked up in their and their parent's trees.
+ */
+    void log(const string& pathSpec = "") {
+        string id = latestCommit();
+        if (id == "NONE") {
+            cout << "There are no commits yet on this branch.\n";
+            return;
+        }
+
+        cout << "\n=========== LOG HISTORY ===========\n\n";
+        if (!pathSpec.empty()) {
+            string target = pathSpec;
+            while (target.compare(0, 2, "./") == 0) target.erase(0, 2);
+            while (!target.empty() && target.back() == '/') target.pop_back();
+
+            size_t shown = 0;
+            uint32_t position = id.empty() ? noCommit : graphPosition(id);
+            while (position != noCommit) {
+                string raw = graph[position].raw;
+                uint32_t parent = graph[position].parents[0];
+                if (filterMayContain(pathFilter(position), target)) {
+                    string before = parent == noCommit ? "" : treeOf(hexOf(graph[parent].raw));
+                    if (treeEntry(rawOf(treeOf(hexOf(raw))), target) != treeEntry(rawOf(before), target)) {
+                        CommitNode node = CommitData(hexOf(raw));
+                        cout << "<" << node.author << "> @ " << node.id << " - \"" << node.comment << "\"\n";
+                        cout << node.timestamp << "\n";
+                        cout << "Previous commit: " << (parent == noCommit ? "NONE" : hexOf(graph[parent].raw)) << "\n";
+                        cout << "----------------------------------------\n";
+                        ++shown;
+                    }
+                }
+                position = parent;
+            }
+            savePathFilters();
+            if (shown == 0) cout << "No commit on this branch changed " << target << "\n";
+            return;
+        }
+        while (!id.empty() && id != "NONE") {
+            CommitNode node = CommitData(id);
+
+            if (node.id.empty()) {
+                cerr << "Invalid or unreadable commit: " << id << "\n";
+                break;
+            }
+
+            cout << "<" << node.author << "> @ " << node.id << " - \"" << node.comment << "\"\n";
+            cout << node.timestamp << "\n";
+
+            if (node.prevCommit.empty()) {
+                cout << "Previous commit: NONE\n";
+                break;
+            }
+
+            int commaIdx = node.prevCommit.find(',');
+            string prevCommitID = (commaIdx != string::npos) ? node.prevCommit.substr(0, commaIdx) : node.prevCommit;
+
+            cout << "Previous commit: " << prevCommitID << "\n";
+            cout << "----------------------------------------\n";
+            id = prevCommitID;
+        }
+    }
+
+/**
+ * branch - Creates a new branch pointing to the current commit
+ * @name: new branch name
+ * @Author: author of the new branch
+ */
+    void branch(const string& name, const string& Author) {
+        path branchPath = repoPath / "refs" / name;
+        if (exists(branchPath)) {
+            cout << "It already exists - Branch" << name << "\n";
+            return;
+        }
+
+        string commitHash = latestCommit();
+
+        const string absent;
+        if (!writeRef(branchPath, commitHash, &absent)) return;
+
+        recordAuthor(name, Author);
+
+        cout << "Branch @" << name << " successfully created at commit " << commitHash << "\n";
+    }
+
+/**
+ * checkout - switches to a given commit or branch
+ * @targetHash: branch name or commit ID 
+ *
+ * Only files that differ between the current and the target commit are touched.
+ * Checking out is refused while a merge is in progress.
+ */
+        void checkout(const string& targetHash) {
+            if (exists(repoPath / "MERGE_HEAD")) {
+                cerr << "A merge is in progress, commit it or run merge --abort first\n";
+                return;
+            }
+            string resolvedHash = findHash(targetHash);
+            if (resolvedHash.empty()) return;
+
+            string head = activeBranch();
+            bool onBranch;
+            string currentHash = refValue(repoPath / "refs" / head, &onBranch);
+            if (!onBranch) currentHash = hasCommit(head) ? head : "";
+
+            vector<pair<string, string>> changes;
+            if (!recoverChanges(resolvedHash, currentHash, changes) || clobbersLocalEdits(changes, "checkout"))
+                return;
+    
+            if (!writeRef(repoPath / "HEAD", targetHash)) return;
+    
+            if (exists(repoPath / "refs" / targetHash)) {
+                cout << "Branch switched to " << targetHash << "\n";
+            } else {
+                cout << "went to commit @" << targetHash << "\n";
+            }
+    
+            applyChanges(changes);
+            cout << "Files are restored successfully from commit - " << resolvedHash << "\n";
+        }
+
+
+/**
+ * compressObject - compresses content the way loose objects are stored
+ * @type: object type recorded in the header
+ * @content: the object content
+ * Return: compressed "<type> <size>\0content" stream
+ */
+    string compressObject(const string& type, const string& content) {
+        ostringstream buffer;
+        auto [method, level] = compression();
+        Compressor compressor(buffer, method, level);
+        string header = type.empty() ? "" : type + " " + to_string(content.size()) + '\0';
+        compressor.write(header.data(), header.size());
+        compressor.write(content.data(), content.size());
+        compressor.finish();
+        return buffer.str();
+    }
+/**
+ * peekHeader - reads the type and size from the start of a compressed object
+ * @prefix: the first bytes of the compressed stream
+ * @type: set to the object type
+ * @size: set to the content size
+ */
+    void peekHeader(string_view prefix, string& type, uint64_t& size) {
+        Decompressor decompressor;
+        string header;
+        decompressor.feed(prefix.data(), prefix.size(), [&](const char* data, size_t len) {
+            header.append(data, len);
+            return header.find('\0') == string::npos;
+        });
+        istringstream hStream(header.substr(0, header.find('\0')));
+        hStream >> type >> size;
+    }
+/**
+ * chooseDeltas - picks delta bases for the blobs about to be packed
+ * @sources: pack sources; chosen blobs get a delta payload
+ * Return: number of new deltas
+ *
+ * Each blob is tried against the previous version of the same path, found by
+ * comparing every commit's snapshot with its first parent's, and against the
+ * blobs just below it in size. The smallest delta wins if it beats the whole
+ * object. Chains deeper than deltaDepth are cut back to whole objects, and
+ * blobs that existing deltas build on stay whole so old chains keep their depth.
+ */
+    size_t chooseDeltas(vector<PackSource>& sources) {
+        int maxDepth = int(min<uint64_t>(numberSetting("deltaDepth", 10), INT_MAX));
+        uint64_t maxSize = numberSetting("deltaMaxSize", 16 << 20);
+        size_t window = numberSetting("deltaWindow", 10);
+
+        unordered_map<string, size_t> byRaw;
+        unordered_map<string, string> baseOf;
+        for (size_t i = 0; i < sources.size(); ++i) {
+            byRaw[sources[i].raw] = i;
+            if (sources[i].kind == packDelta) baseOf[sources[i].raw] = sources[i].base;
+        }
+
+        unordered_map<string, string> previousVersion;
+        for (const PackSource& source : sources) {
+            if (source.type != "commit") continue;
+            CommitNode node = CommitData(hexOf(source.raw));
+            string parent = node.prevCommit.substr(0, node.prevCommit.find(','));
+            if (parent.empty()) continue;
+            diffTrees(rawOf(treeOf(parent)), rawOf(treeOf(node.id)), "", [&](const string&, string_view was, string_view now) {
+                if (!was.empty() && !now.empty()) previousVersion.emplace(string(now), string(was));
+            });
+        }
+
+        unordered_set<string> fixedBases;
+        for (const auto& [_, base] : baseOf)
+            fixedBases.insert(base);
+
+        vector<size_t> candidates;
+        for (size_t i = 0; i < sources.size(); ++i)
+            if (sources[i].kind == packWhole && sources[i].type == "blob" && !fixedBases.count(sources[i].raw)
+                && sources[i].size >= 64 && sources[i].size <= maxSize)
+                candidates.push_back(i);
+        sort(candidates.begin(), candidates.end(), [&](size_t a, size_t b) { return sources[a].size < sources[b].size; });
+
+        auto chainDepth = [&](string raw) {
+            int depth = 0;
+            for (auto it = baseOf.find(raw); it != baseOf.end() && depth <= maxDepth; it = baseOf.find(raw)) {
+                raw = it->second;
+                ++depth;
+            }
+            return depth;
+        };
+        auto reaches = [&](string raw, const string& target) {
+            for (int depth = 0; depth <= maxDepth + 1; ++depth) {
+                if (raw == target) return true;
+                auto it = baseOf.find(raw);
+                if (it == baseOf.end()) return false;
+                raw = it->second;
+            }
+            return true;
+        };
+
+        size_t chosen = 0;
+        for (size_t k = 0; k < candidates.size(); ++k) {
+            PackSource& target = sources[candidates[k]];
+            vector<string> options;
+            auto previous = previousVersion.find(target.raw);
+            if (previous != previousVersion.end() && byRaw.count(previous->second))
+                options.push_back(previous->second);
+            for (size_t w = 1; w <= window && w <= k; ++w)
+                options.push_back(sources[candidates[k - w]].raw);
+
+            auto targetContent = deltaContentOf(target.raw);
+            if (!targetContent) continue;
+            string bestBase, bestDelta;
+            for (const string& option : options) {
+                if (option == target.raw || reaches(option, target.raw) || chainDepth(option) + 1 > maxDepth)
+                    continue;
+                auto baseContent = deltaContentOf(option);
+                if (!baseContent) continue;
+                string delta = deltaOf(*baseContent, *targetContent);
+                if (bestBase.empty() || delta.size() < bestDelta.size()) {
+                    bestBase = option;
+                    bestDelta = move(delta);
+                }
+            }
+            if (bestBase.empty() || bestDelta.size() >= targetContent->size() / 2) continue;
+
+            string payload = bestBase + compressObject("", bestDelta);
+            if (target.wholeSize && payload.size() >= target.wholeSize) continue;
+            target.kind = packDelta;
+            target.base = bestBase;
+            target.delta = make_shared<string>(move(payload));
+            baseOf[target.raw] = bestBase;
+            ++chosen;
+        }
+
+        unordered_map<string, int> depths;
+        function<int(const string&)> depthOf = [&](const string& raw) {
+            auto known = depths.find(raw);
+            if (known != depths.end()) return known->second;
+            auto it = baseOf.find(raw);
+            int depth = 0;
+            if (it != baseOf.end()) {
+                depth = depthOf(it->second) + 1;
+                PackSource& source = sources[byRaw[raw]];
+                if (depth > maxDepth && source.delta) {
+                    source.kind = packWhole;
+                    source.delta.reset();
+                    baseOf.erase(raw);
+                    depth = 0;
+                    --chosen;
+                }
+            }
+            return depths[raw] = depth;
+        };
+        for (PackSource& source : sources) {
+            depthOf(source.raw);
+            if (source.delta) {
+                auto delta = source.delta;
+                source.payload = [delta] { return *delta; };
+            }
+        }
+        return chosen;
+    }
+/**
+ * deltaContentOf - loads an object being packed, for delta comparisons
+ * @raw: raw object hash
+ * Return: the object content, or nullptr if it cannot be read
+ */
+    shared_ptr<const string> deltaContentOf(const string& raw) {
+        string hash = hexOf(raw);
+        if (auto cached = deltaBases.get(hash)) return cached;
+        string content;
+        if (!readObject(hash, [&](const char* data, size_t len) { content.append(data, len); return true; }))
+            return nullptr;
+        return deltaBases.put(hash, move(content));
+    }
+
+/**
+ * markReachable - finds everything reachable from the refs, the stages and MERGE_HEAD
+ * @reachable: receives the raw hashes of reachable commits and objects
+ * @chunked: receives the reachable chunk manifests by raw hash, if not nullptr
+ *
+ * Commits are walked through all their parents first. Their snapshots are
+ * then expanded one tree level at a time, each level read on a worker pool,
+ * and finally the reachable blobs are checked in parallel for chunk
+ * manifests, whose chunks are reachable as well.
+ */
+    void markReachable(unordered_set<string>& reachable, unordered_map<string, string>* chunked = nullptr) {
+        TraceSpan span("markReachable");
+        vector<string> commits, snapshots, blobs;
+        error_code ec;
+        for (const auto& entry : directory_iterator(repoPath / "refs", ec))
+            commits.push_back(refValue(entry.path()));
+        commits.push_back(refValue(repoPath / "MERGE_HEAD"));
+        for (size_t i = 0; i < commits.size(); ++i) {
+            string id = commits[i];
+            if (id.empty() || !reachable.insert(rawOf(id)).second) continue;
+            CommitNode node = CommitData(id);
+            istringstream parents(node.prevCommit);
+            string parent;
+            while (getline(parents, parent, ','))
+                commits.push_back(parent);
+            if (!node.stageSnap.empty() && reachable.insert(rawOf(node.stageSnap)).second)
+                snapshots.push_back(node.stageSnap);
+        }
+
+        auto markBlob = [&](string_view raw) {
+            if (reachable.emplace(raw).second) blobs.push_back(hexOf(raw));
+        };
+        for (const auto& entry : directory_iterator(repoPath / "stages", ec)) {
+            if (!isStageFile(entry.path())) continue;
+            StageView stage(entry.path(), false);
+            for (size_t i = 0; i < stage.size(); ++i)
+                markBlob(stage[i].hash);
+        }
+
+        while (!snapshots.empty()) {
+            vector<vector<string>> dirs(snapshots.size()), files(snapshots.size());
+            parallelFor(snapshots.size(), [&](size_t s) {
+                string content, type;
+                readObject(snapshots[s], [&](const char* data, size_t len) {
+                    content.append(data, len);
+                    return true;
+                }, &type);
+                vector<TreeEntry> entries;
+                if (type == "tree" && parseTree(content, hashSize(), entries)) {
+                    for (const auto& entry : entries)
+                        (entry.dir ? dirs[s] : files[s]).emplace_back(entry.raw);
+                } else if (type == "stage") {
+                    StageView stage(move(content));
+                    for (size_t i = 0; i < stage.size(); ++i)
+                        files[s].emplace_back(stage[i].hash);
+                }
+            });
+            snapshots.clear();
+            for (size_t s = 0; s < dirs.size(); ++s) {
+                for (const string& raw : dirs[s])
+                    if (reachable.insert(raw).second) snapshots.push_back(hexOf(raw));
+                for (const string& raw : files[s])
+                    markBlob(raw);
+            }
+        }
+
+        vector<string> manifests(blobs.size());
+        parallelFor(blobs.size(), [&](size_t b) {
+            string type;
+            readObject(blobs[b], [&](const char* data, size_t len) {
+                if (type != "chunks") return false;
+                manifests[b].append(data, len);
+                return true;
+            }, &type, false);
+        });
+        for (size_t b = 0; b < blobs.size(); ++b) {
+            const string& manifest = manifests[b];
+            uint64_t length;
+            for (size_t pos = 0; manifest.size() - pos >= hashSize();) {
+                reachable.emplace(manifest.substr(pos, hashSize()));
+                pos += hashSize();
+                if (!getVarint(manifest, pos, length)) break;
+            }
+            if (chunked && !manifest.empty()) (*chunked)[rawOf(blobs[b])] = move(manifests[b]);
+        }
+    }
+/**
+ * prune - deletes loose objects and commits that nothing refers to any more
+ * @grace: seconds an unreachable file must have been left untouched
+ * Return: raw hashes of the reachable commits and objects
+ *
+ * Files younger than @grace are kept, so objects a concurrent command wrote
+ * before updating its refs survive. Stale temporary files are removed too.
+ */
+    unordered_set<string> prune(uint64_t grace) {
+        TraceSpan span("prune");
+        unordered_set<string> reachable;
+        markReachable(reachable);
+
+        auto cutoff = file_time_type::clock::now() - chrono::seconds(grace);
+        size_t objects = 0, commits = 0;
+        uintmax_t bytes = 0;
+        auto sweep = [&](const path& file, const string& name, size_t& counter) {
+            error_code ec;
+            string raw = rawOf(name);
+            bool temp = file.filename().string().compare(0, 5, ".tmp-") == 0;
+            if (!temp && (raw.size() != hashSize() || reachable.count(raw))) return;
+            auto modified = last_write_time(file, ec);
+            if (ec || modified > cutoff) return;
+            uintmax_t size = file_size(file, ec);
+            if (remove(file, ec)) {
+                ++counter;
+                bytes += size;
+            }
+        };
+
+        error_code ec;
+        for (const auto& entry : directory_iterator(repoPath / "objects", ec)) {
+            string name = entry.path().filename().string();
+            if (entry.is_directory() && name.size() == 2) {
+                for (const auto& object : directory_iterator(entry.path(), ec))
+                    sweep(object.path(), name + object.path().stem().string(), objects);
+            } else if (entry.is_regular_file()) {
+                sweep(entry.path(), name, objects);
+            }
+        }
+        for (const auto& entry : directory_iterator(repoPath / "commits", ec))
+            sweep(entry.path(), entry.path().filename().string(), commits);
+        for (const auto& entry : directory_iterator(repoPath / "stages", ec))
+            sweep(entry.path(), "", objects);
+
+        cout << "Pruned " << objects << " objects and " << commits << " commits (" << bytes << " bytes)\n";
+        return reachable;
+    }
+/**
+ * pruneGrace - resolves the grace period of prune
+ * @grace: set to seconds, from the pruneGrace setting or two weeks
+ * Return: false, with an error printed, if the setting isn't a number
+ */
+    bool pruneGrace(uint64_t& grace) {
+        string configured = setting("pruneGrace", "1209600");
+        if (parseNumber(configured, grace)) return true;
+        cerr << "Invalid pruneGrace setting - " << configured << ", expected seconds\n";
+        return false;
+    }
+/**
+ * fsck - re-hashes every object and checks what the refs reach
+ *
+ * Objects and commits, loose and packed, are read back streaming on a worker
+ * pool, largest first, and must hash to their names. The reachability walk
+ * of prune runs first and finds objects that are referenced but missing, and
+ * stored ones nothing reaches. Chunk manifests are verified last by streaming
+ * their chunks once, each chunk hashed for its own name and the whole content
+ * at the same time, so chunk bytes are neither read nor counted twice.
+ */
+    void fsck() {
+        TraceSpan span("fsck");
+        struct Item {
+            string hash;
+            uint64_t size;
+            bool looseCommit;
+        };
+        vector<Item> items;
+        unordered_set<string> present;
+        auto addItem = [&](const string& raw, uint64_t size, bool looseCommit) {
+            if (raw.size() == hashSize() && present.insert(raw).second)
+                items.push_back({ hexOf(raw), size, looseCommit });
+        };
+
+        error_code ec;
+        for (const auto& entry : directory_iterator(repoPath / "objects", ec)) {
+            string name = entry.path().filename().string();
+            if (entry.is_directory() && name.size() == 2) {
+                for (const auto& object : directory_iterator(entry.path(), ec))
+                    addItem(rawOf(name + object.path().stem().string()), object.file_size(ec), false);
+            } else if (entry.is_regular_file()) {
+                addItem(rawOf(name), entry.file_size(ec), false);
+            }
+        }
+        for (const auto& entry : directory_iterator(repoPath / "commits", ec))
+            addItem(rawOf(entry.path().filename().string()), entry.file_size(ec), true);
+        for (const auto& pack : loadPacks())
+            for (size_t i = 0; i < pack->size(); ++i) {
+                uint8_t kind;
+                string_view payload;
+                pack->entryAt(pack->offsetAt(i), kind, payload);
+                addItem(string(pack->hashAt(i)), payload.size(), false);
+            }
+        sort(items.begin(), items.end(), [](const Item& a, const Item& b) { return a.size > b.size; });
+
+        for (const auto& entry : directory_iterator(repoPath / "stages", ec))
+            if (isStageFile(entry.path()))
+                StageView(entry.path(), true);
+        unordered_set<string> reachable;
+        unordered_map<string, string> chunked;
+        markReachable(reachable, &chunked);
+
+        unordered_map<string, size_t> itemOf;
+        for (size_t i = 0; i < items.size(); ++i)
+            itemOf[rawOf(items[i].hash)] = i;
+        auto chunksOf = [&](const string& manifest) {
+            vector<pair<size_t, uint64_t>> chunks;
+            for (size_t pos = 0; manifest.size() - pos >= hashSize();) {
+                auto it = itemOf.find(manifest.substr(pos, hashSize()));
+                pos += hashSize();
+                uint64_t length;
+                if (!getVarint(manifest, pos, length)) break;
+                chunks.push_back({ it == itemOf.end() ? items.size() : it->second, length });
+            }
+            return chunks;
+        };
+        vector<uint8_t> isManifest(items.size()), isChunk(items.size());
+        for (const auto& [raw, manifest] : chunked) {
+            auto it = itemOf.find(raw);
+            if (it != itemOf.end()) isManifest[it->second] = true;
+            for (const auto& chunk : chunksOf(manifest))
+                if (chunk.first < items.size()) isChunk[chunk.first] = true;
+        }
+
+        auto start = chrono::steady_clock::now();
+        atomic<uint64_t> bytes{0};
+        vector<uint8_t> corrupt(items.size());
+        vector<atomic<bool>> checked(items.size());
+        vector<string> manifests(items.size());
+        parallelFor(items.size(), [&](size_t i) {
+            if (isManifest[i] || isChunk[i]) return;
+            Digest digest(objectHash);
+            uint64_t read = 0;
+            bool complete;
+            string type;
+            if (items[i].looseCommit) {
+                string text = commitText(items[i].hash);
+                digest.update(text.data(), text.size());
+                read = text.size();
+                complete = !text.empty();
+            } else {
+                complete = readObject(items[i].hash, [&](const char* data, size_t len) {
+                    if (type == "chunks") {
+                        manifests[i].append(data, len);
+                        return true;
+                    }
+                    digest.update(data, len);
+                    read += len;
+                    return true;
+                }, &type, false);
+            }
+            if (type == "chunks") {
+                isManifest[i] = complete;
+                corrupt[i] = !complete;
+                return;
+            }
+            checked[i] = true;
+            Tracer::add(Tracer::bytesHashed, read);
+            bytes += read;
+            corrupt[i] = !complete || digest.hex() != items[i].hash;
+        });
+
+        vector<size_t> order;
+        for (size_t i = 0; i < items.size(); ++i)
+            if (isManifest[i]) {
+                if (manifests[i].empty()) manifests[i] = move(chunked[rawOf(items[i].hash)]);
+                order.push_back(i);
+            }
+        sort(order.begin(), order.end(), [&](size_t a, size_t b) { return manifests[a].size() > manifests[b].size(); });
+        parallelFor(order.size(), [&](size_t m) {
+            size_t i = order[m];
+            Digest whole(objectHash);
+            bool complete = true;
+            for (const auto& [c, length] : chunksOf(manifests[i])) {
+                Digest digest(objectHash);
+                uint64_t read = 0;
+                bool chunkRead = c < items.size() && readObject(items[c].hash, [&](const char* data, size_t len) {
+                    digest.update(data, len);
+                    whole.update(data, len);
+                    read += len;
+                    return true;
+                });
+                Tracer::add(Tracer::bytesHashed, read);
+                complete = complete && chunkRead && read == length;
+                if (c < items.size() && !checked[c].exchange(true)) {
+                    bytes += read;
+                    corrupt[c] = !chunkRead || digest.hex() != items[c].hash;
+                }
+            }
+            corrupt[i] = !complete || whole.hex() != items[i].hash;
+        });
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        vector<string> missing, dangling;
+        for (const string& raw : reachable)
+            if (!present.count(raw)) missing.push_back(hexOf(raw));
+        for (const string& raw : present)
+            if (!reachable.count(raw)) dangling.push_back(hexOf(raw));
+        sort(missing.begin(), missing.end());
+        sort(dangling.begin(), dangling.end());
+
+        size_t corrupted = 0;
+        for (size_t i = 0; i < items.size(); ++i)
+            if (corrupt[i]) {
+                cerr << "corrupt " << items[i].hash << "\n";
+                ++corrupted;
+            }
+        for (const string& hash : missing)
+            cerr << "missing " << hash << "\n";
+        for (const string& hash : dangling)
+            cout << "dangling " << hash << "\n";
+
+        cout << "Checked " << items.size() << " objects, " << fixed << setprecision(1) << bytes / 1e6 << " MB in "
+             << setprecision(2) << seconds << " s (" << (seconds > 0 ? bytes / 1e9 / seconds : 0.0) << " GB/s): "
+             << corrupted << " corrupt, " << missing.size() << " missing, " << dangling.size() << " dangling\n"
+             << defaultfloat;
+    }
+
+/**
+ * gc - packs loose objects, commits and existing packs into a single packfile
+ * @pruning: drop unreachable objects as well
+ * @grace: seconds an unreachable object must be left untouched to be dropped
+ *
+ * Loose compressed objects are copied into the pack as-is; legacy flat
+ * objects and commits are compressed on the way in. Blobs are then
+ * delta-encoded against similar blobs where that saves space. The packed loose files
+ * and the old packs are removed once the new pack and index are in place.
+ * When pruning, unreachable loose files are deleted first, and unreachable
+ * objects of packs older than @grace are left out of the new pack, unless a
+ * kept delta is based on them.
+ */
+    void gc(bool pruning = false, uint64_t grace = 0) {
+        path packDir = repoPath / "objects" / "pack";
+        create_directories(packDir);
+
+        unordered_set<string> keep;
+        size_t dropped = 0;
+        if (pruning) {
+            keep = prune(grace);
+            auto cutoff = file_time_type::clock::now() - chrono::seconds(grace);
+            unordered_map<string, string> baseOf;
+            for (const auto& pack : loadPacks()) {
+                error_code ec;
+                bool young = last_write_time(pack->packPath, ec) > cutoff;
+                for (size_t i = 0; i < pack->size(); ++i) {
+                    uint8_t kind;
+                    string_view payload;
+                    if (young) keep.emplace(pack->hashAt(i));
+                    if (pack->entryAt(pack->offsetAt(i), kind, payload) && kind == packDelta)
+                        baseOf.emplace(pack->hashAt(i), payload.substr(0, hashSize()));
+                }
+            }
+            for (const auto& [raw, base] : baseOf) {
+                if (!keep.count(raw)) continue;
+                for (string next = base; keep.insert(next).second;) {
+                    auto further = baseOf.find(next);
+                    if (further == baseOf.end()) break;
+                    next = further->second;
+                }
+            }
+        }
+
+        auto slurp = [](const path& filePath) {
+            ifstream in(filePath, ios::binary);
+            stringstream buffer;
+            buffer << in.rdbuf();
+            return buffer.str();
+        };
+
+        vector<PackSource> sources;
+        unordered_set<string> seen;
+        vector<path> packedFiles;
+        size_t looseObjects = 0, looseCommits = 0;
+        auto addSource = [&](PackSource source) {
+            if (source.raw.size() == hashSize() && seen.insert(source.raw).second)
+                sources.push_back(move(source));
+        };
+
+        error_code ec;
+        for (const auto& entry : directory_iterator(repoPath / "objects", ec)) {
+            string name = entry.path().filename().string();
+            if (entry.is_directory() && name.size() == 2) {
+                for (const auto& object : directory_iterator(entry.path(), ec)) {
+                    path objectFile = object.path();
+                    if (objectFile.extension() == ".raw") continue;
+                    PackSource source;
+                    source.raw = rawOf(name + objectFile.filename().string());
+                    source.payload = [=] { return slurp(objectFile); };
+                    source.wholeSize = object.file_size(ec);
+                    ifstream in(objectFile, ios::binary);
+                    string prefix(256, '\0');
+                    in.read(prefix.data(), prefix.size());
+                    prefix.resize(in.gcount());
+                    peekHeader(prefix, source.type, source.size);
+                    addSource(move(source));
+                    packedFiles.push_back(objectFile);
+                    ++looseObjects;
+                }
+            } else if (entry.is_regular_file() && rawOf(name).size() == hashSize()) {
+                path objectFile = entry.path();
+                PackSource source;
+                source.raw = rawOf(name);
+                source.type = "blob";
+                source.size = entry.file_size(ec);
+                source.payload = [=] { return compressObject("blob", slurp(objectFile)); };
+                source.wholeSize = source.size;
+                addSource(move(source));
+                packedFiles.push_back(objectFile);
+                ++looseObjects;
+            }
+        }
+        for (const auto& entry : directory_iterator(repoPath / "commits", ec)) {
+            path commitFile = entry.path();
+            PackSource source;
+            source.raw = rawOf(commitFile.filename().string());
+            source.type = "commit";
+            source.payload = [=] { return compressObject("commit", slurp(commitFile)); };
+            if (source.raw.size() != hashSize()) continue;
+            addSource(move(source));
+            packedFiles.push_back(commitFile);
+            ++looseCommits;
+        }
+        for (const auto& pack : loadPacks()) {
+            for (size_t i = 0; i < pack->size(); ++i) {
+                PackSource source;
+                string_view payload;
+                if (!pack->entryAt(pack->offsetAt(i), source.kind, payload)) continue;
+                source.raw = string(pack->hashAt(i));
+                if (pruning && !keep.count(source.raw)) {
+                    ++dropped;
+                    continue;
+                }
+                source.payload = [=] { return string(payload); };
+                source.wholeSize = payload.size();
+                if (source.kind == packDelta) {
+                    source.type = "blob";
+                    source.base = string(payload.substr(0, hashSize()));
+                } else {
+                    peekHeader(payload.substr(0, 256), source.type, source.size);
+                }
+                addSource(move(source));
+            }
+        }
+
+        if (sources.empty() || (looseObjects + looseCommits + dropped == 0 && packs.size() == 1)) {
+            cout << "Nothing to pack\n";
+            return;
+        }
+
+        size_t deltas = chooseDeltas(sources);
+
+        path tempPack = tempFile(packDir);
+        ofstream out(tempPack, ios::binary | ios::trunc);
+        EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+        EVP_DigestInit_ex(ctx, EVP_sha1(), nullptr);
+        uint64_t offset = 0;
+        auto emit = [&](const void* data, size_t len) {
+            EVP_DigestUpdate(ctx, data, len);
+            out.write(static_cast<const char*>(data), len);
+            offset += len;
+        };
+
+        uint32_t count = sources.size();
+        emit(packMagic, 4);
+        emit(&packVersion, 4);
+        emit(&count, 4);
+
+        vector<pair<string, uint64_t>> entries;
+        entries.reserve(count);
+        for (const PackSource& source : sources) {
+            string payload = source.payload();
+            uint64_t length = payload.size();
+            entries.emplace_back(source.raw, offset);
+            emit(&source.kind, 1);
+            emit(&length, 8);
+            emit(payload.data(), payload.size());
+        }
+
+        unsigned char digest[EVP_MAX_MD_SIZE];
+        unsigned int digestLen;
+        EVP_DigestFinal_ex(ctx, digest, &digestLen);
+        EVP_MD_CTX_free(ctx);
+        string packSum(reinterpret_cast<char*>(digest), digestLen);
+        out << packSum;
+        out.close();
+        if (!out) {
+            remove(tempPack, ec);
+            cerr << "Unable to write the pack\n";
+            return;
+        }
+
+        sort(entries.begin(), entries.end());
+        string index(packIndexMagic, 4);
+        uint32_t hashLen = hashSize();
+        index.append(reinterpret_cast<const char*>(&packVersion), 4);
+        index.append(reinterpret_cast<const char*>(&count), 4);
+        index.append(reinterpret_cast<const char*>(&hashLen), 4);
+        uint32_t fanout[256] = {};
+        for (const auto& [raw, _] : entries)
+            ++fanout[uint8_t(raw[0])];
+        for (int i = 1; i < 256; ++i)
+            fanout[i] += fanout[i - 1];
+        index.append(reinterpret_cast<const char*>(fanout), sizeof(fanout));
+        for (const auto& [raw, _] : entries)
+            index += raw;
+        for (const auto& [_, entryOffset] : entries)
+            index.append(reinterpret_cast<const char*>(&entryOffset), 8);
+        index += packSum;
+        index += checksumOf(index.data(), index.size());
+
+        string name = "pack-" + hexOf(packSum);
+        path tempIndex = tempFile(packDir);
+        ofstream(tempIndex, ios::binary | ios::trunc) << index;
+        rename(tempPack, packDir / (name + ".pack"));
+        rename(tempIndex, packDir / (name + ".idx"));
+        pendingSync(packDir / (name + ".pack"));
+        pendingSync(packDir / (name + ".idx"));
+        syncWrites();
+
+        for (const auto& pack : packs) {
+            if (pack->indexPath.filename() == name + ".idx") continue;
+            remove(pack->indexPath, ec);
+            remove(pack->packPath, ec);
+        }
+        packs.clear();
+        packsLoaded = false;
+        deltaBases.clear();
+        for (const auto& packedFile : packedFiles)
+            remove(packedFile, ec);
+        for (const auto& entry : directory_iterator(repoPath / "objects", ec))
+            if (entry.is_directory() && entry.path().filename() != "pack")
+                remove(entry.path(), ec);
+
+        cout << "Packed " << count << " entries (" << looseObjects << " loose objects, "
+             << looseCommits << " commits, " << deltas << " deltas) into " << name << "\n";
+        if (pruning) cout << dropped << " unreachable packed objects dropped\n";
+    }
+
+/**
+ * writeIndex - replaces a branch's stage, keeping stat data of unchanged paths
+ * @stageLock: the held lock of the branch's stage
+ * @branch: the branch
+ * @entries: paths and raw hashes, sorted by path
+ */
+    void writeIndex(LockFile& stageLock, const string& branch,
+                    const vector<pair<string_view, string_view>>& entries) {
+        StageView index(repoPath / "stages" / branch, true);
+        StageWriter writer;
+        for (const auto& [fileName, hash] : entries) {
+            size_t i = index.find(fileName);
+            StageEntry stat;
+            if (i < index.size() && index[i].hash == hash)
+                stat = index.statAt(i);
+            writer.add(fileName, hash, &stat);
+        }
+        if (stageLock.write(writer.finish()) && stageLock.commit())
+            pendingSync(repoPath / "stages" / branch);
+        else
+            cerr << "Unable to write the stage of " << branch << "\n";
+    }
+/**
+ * mergeTrees - three-way merges trees, descending only where both sides changed
+ * @base: raw hash of the common ancestor's tree, empty for none
+ * @current: raw hash of the current branch's tree, empty for none
+ * @source: raw hash of the merged branch's tree, empty for none
+ * @prefix: path of the trees' directory, empty or ending in '/'
+ * @changes: receives the files to take from @source, an empty hash deleting
+ * @conflicts: receives the files changed differently on both sides
+ * Return: false if a tree could not be read
+ *
+ * A subtree changed on one side only is resolved by its hash alone.
+ */
+    bool mergeTrees(string_view base, string_view current, string_view source, const string& prefix,
+                    map<string, string>& changes, vector<TreeConflict>& conflicts) {
+        if (current == source || base == source) return true;
+        if (base == current)
+            return diffTrees(current, source, prefix, [&](const string& file, string_view, string_view raw) {
+                changes[file] = string(raw);
+            });
+
+        string_view roots[] = { base, current, source };
+        string contents[3];
+        vector<TreeEntry> entries[3];
+        for (int t = 0; t < 3; ++t)
+            if (!readTree(roots[t], contents[t], entries[t])) return false;
+
+        size_t cursor[] = { 0, 0, 0 };
+        while (true) {
+            string key;
+            bool more = false;
+            for (int t = 0; t < 3; ++t)
+                if (cursor[t] < entries[t].size()) {
+                    string candidate = entries[t][cursor[t]].key();
+                    if (!more || candidate < key) key = candidate;
+                    more = true;
+                }
+            if (!more) break;
+
+            string_view raws[3];
+            for (int t = 0; t < 3; ++t)
+                if (cursor[t] < entries[t].size() && entries[t][cursor[t]].key() == key)
+                    raws[t] = entries[t][cursor[t]++].raw;
+
+            string name = prefix + key;
+            if (key.back() == '/') {
+                if (!mergeTrees(raws[0], raws[1], raws[2], name, changes, conflicts)) return false;
+            } else if (raws[1] != raws[2] && raws[0] != raws[2]) {
+                if (raws[0] == raws[1])
+                    changes[name] = string(raws[2]);
+                else
+                    conflicts.push_back({ name, string(raws[0]), string(raws[1]), string(raws[2]) });
+            }
+        }
+        return true;
+    }
+
+/**
+ * merge - merges another branch into the current branch
+ * @branch: name of the branch to merge into the current branch
+ */
+
+    void merge(const string& branch) {  
+        TraceSpan span("merge");
+        string currentBranch = activeBranch();  
+  
+        if (branch == currentBranch) {  
+            cerr << "You can't merge a branch onto itself\n";  
+            return;  
+        }  
+        if (exists(repoPath / "MERGE_HEAD")) {
+            cerr << "A merge is in progress, commit it first\n";
+            return;
+        }
+        LockFile stageLock(repoPath / "stages" / currentBranch);
+        if (!stageLock) {
+            cerr << "The stage of " << currentBranch << " is locked by another process\n";
+            return;
+        }
+  
+        path branchPath = repoPath / "refs" / branch;  
+        if (!exists(branchPath)) {  
+            cerr << "Branch " << branch << " doesn't exist\n";  
+            return;  
+        }  
+        vector<string> staged = stagedChanges(currentBranch);
+        if (!staged.empty()) {
+            cerr << "Your staged changes to these files would be lost by merge:\n";
+            for (const string& file : staged)
+                cerr << "    " << file << "\n";
+            cerr << "Commit them, then try again\n";
+            return;
+        }
+  
+        string currentCommit = latestCommit();  
+        string branchCommit  = latestCommit(branch);  
+        string ancestorCommit = commonAncestor(currentCommit, branchCommit);  
+  
+        if (ancestorCommit.empty()) {  
+            cerr << branch << " and " << currentBranch << " have no common ancestor\n";  
+            return;  
+        }  
+  
+        string trees[] = { treeOf(ancestorCommit), treeOf(currentCommit), treeOf(branchCommit) };
+        if (trees[0].empty() || trees[1].empty() || trees[2].empty()) {
+            cerr << "Unable to read the trees to merge\n";
+            return;
+        }
+
+        map<string, string> changes;
+        vector<TreeConflict> conflicts;
+        {
+            TraceSpan treeSpan("mergeTrees");
+            if (!mergeTrees(rawOf(trees[0]), rawOf(trees[1]), rawOf(trees[2]), "", changes, conflicts)) return;
+        }
+
+        map<string, string> markers;
+        vector<string> unresolved;
+        for (const TreeConflict& conflict : conflicts) {
+            const string* raws[] = { &conflict.base, &conflict.current, &conflict.source };
+            string contents[3];
+            bool binary = false;
+            for (int m = 0; m < 3; ++m) {
+                if (!raws[m]->empty()) contents[m] = loadObject(hexOf(*raws[m]));
+                binary = binary || memchr(contents[m].data(), '\0', min<size_t>(contents[m].size(), 8000));
+            }
+            if (conflict.current.empty() || conflict.source.empty() || binary) {
+                unresolved.push_back(conflict.path);
+                continue;
+            }
+
+            MergeResult result = mergeLines(contents[0], contents[1], contents[2], currentBranch, branch);
+            string hash = storeObject(result.text, "blob");
+            if (hash.empty()) {
+                cerr << "Unable to store the merge of " << conflict.path << "\n";
+                return;
+            }
+            if (result.conflicts == 0) {
+                changes[conflict.path] = rawOf(hash);
+            } else {
+                unresolved.push_back(conflict.path);
+                markers[conflict.path] = rawOf(hash);
+            }
+        }
+
+        vector<pair<string, string>> touched(changes.begin(), changes.end());
+        touched.insert(touched.end(), markers.begin(), markers.end());
+        if (clobbersLocalEdits(touched, "merge")) return;
+
+        auto currentMap = stageOf(currentCommit);
+        vector<pair<string_view, string_view>> mergedStage;
+        auto change = changes.begin();
+        for (size_t i = 0; i < currentMap->size() || change != changes.end();) {
+            int order = i == currentMap->size() ? 1 : change == changes.end() ? -1
+                      : (*currentMap)[i].path.compare(change->first);
+            if (order < 0) {
+                mergedStage.emplace_back((*currentMap)[i].path, (*currentMap)[i].hash);
+                ++i;
+                continue;
+            }
+            if (!change->second.empty()) mergedStage.emplace_back(change->first, change->second);
+            if (order == 0) ++i;
+            ++change;
+        }
+
+        if (!unresolved.empty()) {
+            const string absent;
+            string mergeState = branchCommit + "\n" + currentBranch + "\n";
+            for (const string& file : unresolved)
+                mergeState += file + "\n";
+            if (!writeRef(repoPath / "MERGE_HEAD", mergeState, &absent)) return;
+            writeIndex(stageLock, currentBranch, mergedStage);
+            map<string, string> worktree = changes;
+            for (const auto& [fileName, raw] : markers)
+                worktree[fileName] = raw;
+            applyChanges(vector<pair<string, string>>(worktree.begin(), worktree.end()),
+                         [&](const string& file) { return markers.count(file) > 0; });
+
+            cerr << "Conflict occurred in merge - ";  
+            for (size_t i = 0; i < unresolved.size(); ++i) {  
+                cerr << unresolved[i];  
+                if (i < unresolved.size() - 1) cerr << ", ";  
+            }  
+            cerr << "\nResolve them, then add and commit to finish the merge\n";
+            return;
+        }
+
+        string mergedTree = writeTree(mergedStage);
+        if (mergedTree.empty()) {
+            cerr << "Unable to store the merged tree\n";
+            return;
+        }
+  
+        CommitNode node;  
+        node.stageSnap  = mergedTree;  
+        node.prevCommit = currentCommit + "," + branchCommit;  
+        node.timestamp  = time();  
+        node.author     = Author(currentBranch);  
+        node.comment    = "Merged from " + branch;  
   
-    while (!lineageB.empty()) {  
-        string commitID = lineageB.front(); lineageB.pop();  
-        if (ancestorsA.count(commitID)) return commitID;  
+        string commitText = commitString(node);  
+        string commitID   = hashOf(commitText);  
   
-        istringstream parentStream(CommitData(commitID).prevCommit);  
-        string parent;  
-        while (getline(parentStream, parent, ','))  
-            if (!parent.empty()) lineageB.push(parent);  
-    }  
+        if (!writeFile(repoPath / "commits" / commitID, commitText)
+            || !writeRef(repoPath / "refs" / currentBranch, commitID, &currentCommit))
+            return;
+        recordCommit(commitID);
+
+        writeIndex(stageLock, currentBranch, mergedStage);
   
-    return "";  
+        cout << "Merge Commit @" << commitID << " - " << node.comment << "\n";  
+        applyChanges(vector<pair<string, string>>(changes.begin(), changes.end()));
 }
 
+/**
+ * sparseCheckout - limits the working tree to the files matching patterns
+ * @patterns: cones and globs to keep, none to check out the whole tree again
+ *
+ * The patterns are stored in .minigit/sparse-checkout. Files of the stage
+ * that enter them are written and files that leave them are removed, except
+ * where the working tree holds different content; nothing else is touched.
+ * The patterns can't be changed while a merge is in progress.
+ */
+    void sparseCheckout(const vector<string>& patterns) {
+        if (exists(repoPath / "MERGE_HEAD")) {
+            cerr << "A merge is in progress, commit it or run merge --abort first\n";
+            return;
+        }
+        string branch = activeBranch();
+        SparsePatterns before = sparsePatterns();
+        SparsePatterns after(patterns);
+        path sparsePath = repoPath / "sparse-checkout";
+        if (after.empty()) {
+            error_code ec;
+            remove(sparsePath, ec);
+        } else {
+            string content;
+            for (const string& pattern : patterns)
+                content += pattern + "\n";
+            if (!writeFile(sparsePath, content)) {
+                cerr << "Unable to write the sparse-checkout patterns\n";
+                return;
+            }
+        }
+        sparse = after;
+        sparseLoaded = true;
 
-public:
+        uint64_t indexTime;
+        auto index = currentIndex(indexTime);
+        path workTree = repoPath.parent_path();
+        vector<pair<string, string>> changes;
+        vector<string> kept;
+        for (size_t i = 0; i < index->size(); ++i) {
+            auto entry = (*index)[i];
+            bool was = before.matches(entry.path), now = after.matches(entry.path);
+            if (was == now) continue;
+            path fullPath = workTree / entry.path;
+            StageEntry current;
+            if (!statOf(fullPath, current)) {
+                if (now) changes.emplace_back(entry.path, entry.hash);
+                continue;
+            }
+            if (!statClean(index->statAt(i), current, indexTime) && hashOf(fullPath) != hexOf(entry.hash))
+                kept.emplace_back(entry.path);
+            else if (!now)
+                changes.emplace_back(entry.path, "");
+        }
+        applyChanges(changes);
+        for (const string& file : kept)
+            cout << "Kept " << file << ", it has local changes\n";
+    }
 
 /**
- * MinGit - Constructor for the MinGit object
- * @path: the absolute path of the repository
- * @author: author name for master branch
+ * listSparse - prints the sparse-checkout patterns, nothing without any
  */
-    MinGit(const string& path, const string& author) {
-        repoPath = path + "/.minigit";
-        repoName = repoPath.parent_path().filename().string();
-        this->author = author;
+    void listSparse() {
+        ifstream in(repoPath / "sparse-checkout");
+        string line;
+        while (getline(in, line))
+            cout << line << "\n";
     }
 
 /**
- * init - Initializes .MiniGit repository if not already present
+ * abortMerge - gives up a conflicted merge
+ *
+ * MERGE_HEAD holds the merged commit, the branch merged into and the
+ * conflicted files. The stage goes back to HEAD's snapshot, and the files
+ * the merge wrote, conflicted ones included, are restored from HEAD.
  */
-      void init() {
-        if (exists(repoPath)) {
-            cout << "It is already initialized\n";
+    void abortMerge() {
+        path mergeHead = repoPath / "MERGE_HEAD";
+        ifstream in(mergeHead);
+        string line, into;
+        if (!getline(in, line)) {
+            cerr << "No merge is in progress\n";
             return;
         }
+        getline(in, into);
+        vector<string> conflicted;
+        while (getline(in, line))
+            if (!line.empty()) conflicted.push_back(line);
+        in.close();
 
-        create_directory(repoPath);
-        create_directory(repoPath / "objects");
-        create_directory(repoPath / "refs");
-        create_directory(repoPath / "commits");
-        create_directory(repoPath / "stages");
-        create_directory(repoPath / "authors");
+        string branch = activeBranch();
+        if (!into.empty() && into != branch) {
+            cerr << "The merge in progress is into " << into << ", check it out to abort it\n";
+            return;
+        }
+        LockFile stageLock(repoPath / "stages" / branch);
+        if (!stageLock) {
+            cerr << "The stage of " << branch << " is locked by another process\n";
+            return;
+        }
 
-        ofstream headFile(repoPath / "HEAD");
-        headFile << "master";
-        headFile.close();
+        string head = latestCommit();
+        auto headSnapshot = head.empty() ? make_shared<const StageView>() : stageOf(head);
+        const StageView& committed = *headSnapshot;
+        StageView stage(repoPath / "stages" / branch, true);
+        map<string, string> changes;
+        joinStages({ &stage, &committed }, [&](string_view file, const vector<size_t>& at) {
+            bool staged = at[0] < stage.size(), tracked = at[1] < committed.size();
+            if (staged && tracked && stage[at[0]].hash == committed[at[1]].hash) return;
+            changes[string(file)] = tracked ? string(committed[at[1]].hash) : "";
+        });
+        for (const string& file : conflicted) {
+            size_t i = committed.find(file);
+            changes[file] = i < committed.size() ? string(committed[i].hash) : "";
+        }
 
-        branch("master", author);
-        cout << repoName << " is initialized successfully\n";
+        vector<pair<string_view, string_view>> entries;
+        entries.reserve(committed.size());
+        for (size_t i = 0; i < committed.size(); ++i)
+            entries.emplace_back(committed[i].path, committed[i].hash);
+        writeIndex(stageLock, branch, entries);
+        applyChanges(vector<pair<string, string>>(changes.begin(), changes.end()));
+        error_code ec;
+        remove(mergeHead, ec);
+        cout << "Merge aborted, " << branch << " is back at " << (head.empty() ? "no commit" : head) << "\n";
     }
 
 /**
- * add - stages a file for commit by recording its blob hash
- * @filePath: path to the file to be added
+ * status - lists staged, modified, deleted and untracked files
+ *
+ * The stage is compared with HEAD's snapshot, and the working tree with the
+ * stage. Working-tree files are stat'ed in parallel and only hashed when
+ * their stat data doesn't match the stage; files found unchanged that way
+ * get their stat data refreshed in the stage, so the next run skips them.
+ * The refresh is skipped when another process holds or has since replaced
+ * the stage.
  */
-    void add(const path& filePath) {
+    void status() {
+        TraceSpan span("status");
         string branch = activeBranch();
+        string head = latestCommit();
         path stagePath = repoPath / "stages" / branch;
+        path workTree = repoPath.parent_path();
 
-        if (!exists(stagePath)) {
-            ofstream indexStream(stagePath, ios::app);
-            indexStream.close();
-        }
+        auto headSnapshot = head.empty() ? make_shared<const StageView>() : stageOf(head);
+        StageView stage(stagePath, true);
+        uint64_t indexTime = 0;
+        StageEntry stageStat;
+        if (statOf(stagePath, stageStat)) indexTime = stageStat.mtimeNs;
+        const StageView& index = stage.empty() ? *headSnapshot : stage;
 
-        path rootPath = repoPath.parent_path();
-        path relativeRepo = rootPath / filePath;
-        path absolutePath = filesystem::weakly_canonical(relativeRepo);
+        vector<string> files;
+        walkTree(workTree, [&](const string& file) { files.push_back(file); }, &index);
 
-        string relativePath = relative(absolutePath, repoPath.parent_path()).string();
+        enum State : uint8_t { untracked, clean, modified, refreshed };
+        vector<State> states(files.size());
+        vector<StageEntry> stats(files.size());
+        parallelFor(files.size(), [&](size_t f) {
+            size_t i = index.find(files[f]);
+            if (i == index.size()) {
+                states[f] = untracked;
+                return;
+            }
+            if (!statOf(workTree / files[f], stats[f])) {
+                states[f] = modified;
+                return;
+            }
+            if (statClean(index.statAt(i), stats[f], indexTime)) {
+                states[f] = clean;
+                return;
+            }
+            states[f] = hashOf(workTree / files[f]) == hexOf(index[i].hash) ? refreshed : modified;
+        });
 
-        unordered_map<string, string> stageMap = stageOf(stagePath);
+        vector<string> staged, changed, untrackedFiles;
+        const StageView& before = *headSnapshot;
+        joinStages({ &before, &index }, [&](string_view file, const vector<size_t>& at) {
+            if (at[1] == index.size()) staged.push_back("deleted:  " + string(file));
+            else if (at[0] == before.size()) staged.push_back("new file: " + string(file));
+            else if (before[at[0]].hash != index[at[1]].hash) staged.push_back("modified: " + string(file));
+        });
 
-        if (!exists(absolutePath)) {
-            cerr << "File doesn't exist - " << relativePath << "\n";
-            return;
+        size_t f = 0, refreshes = 0;
+        for (size_t k = 0; k < index.size(); ++k) {
+            string_view file = index[k].path;
+            while (f < files.size() && files[f] < file) {
+                if (states[f] == untracked) untrackedFiles.push_back(files[f]);
+                ++f;
+            }
+            if (f == files.size() || files[f] != file) {
+                if (sparsePatterns().matches(file)) changed.push_back("deleted:  " + string(file));
+                continue;
+            }
+            if (states[f] == modified) changed.push_back("modified: " + files[f]);
+            refreshes += states[f] == refreshed;
+            ++f;
         }
+        for (; f < files.size(); ++f)
+            if (states[f] == untracked) untrackedFiles.push_back(files[f]);
 
-        string blobFile = blob(absolutePath);
-        if (blobFile.empty()) {
-            cerr << "blobbing failed - " << relativePath << "\n";
-            return;
+        if (refreshes > 0 && !stage.empty()) {
+            LockFile stageLock(stagePath);
+            StageEntry lockedStat;
+            bool current = stageLock && statOf(stagePath, lockedStat)
+                        && lockedStat.mtimeNs == stageStat.mtimeNs && lockedStat.inode == stageStat.inode;
+            StageWriter writer;
+            for (size_t k = 0, w = 0; k < stage.size(); ++k) {
+                StageEntry stat = stage.statAt(k);
+                while (w < files.size() && files[w] < stage[k].path) ++w;
+                if (w < files.size() && files[w] == stage[k].path && states[w] == refreshed)
+                    stat = stats[w];
+                writer.add(stage[k].path, stage[k].hash, &stat);
+            }
+            if (current && stageLock.write(writer.finish()) && stageLock.commit())
+                pendingSync(stagePath);
         }
 
-        bool alreadyStaged = stageMap.count(relativePath);
+        cout << "On branch " << branch << "\n";
+        ifstream mergeHead(repoPath / "MERGE_HEAD");
+        string merging;
+        if (getline(mergeHead, merging))
+            cout << "Merge in progress with " << merging << " (commit to conclude it, or use merge --abort)\n";
+        auto section = [](const string& title, const vector<string>& lines) {
+            if (lines.empty()) return;
+            cout << "\n" << title << ":\n";
+            for (const string& line : lines)
+                cout << "    " << line << "\n";
+        };
+        section("Changes to be committed", staged);
+        section("Changes not staged for commit", changed);
+        section("Untracked files", untrackedFiles);
+        if (staged.empty() && changed.empty() && untrackedFiles.empty())
+            cout << "Nothing to commit, working tree clean\n";
+    }
 
-        if (alreadyStaged && stageMap[relativePath] == blobFile) {
-            cout << "File is already staged - " << relativePath << "\n";
-            return;
+/**
+ * diff - prints the line changes between two versions of the tracked files
+ * @from: commit or branch to compare from, empty for the stage
+ * @to: commit or branch to compare to, empty for the working tree
+ *
+ * Working-tree files whose stat data matches the stage are skipped unread,
+ * and two commits are compared tree by tree, skipping shared subtrees.
+ */
+    void diff(const string& from, const string& to) {
+        TraceSpan span("diff");
+        string branch = activeBranch();
+        path stagePath = repoPath / "stages" / branch;
+        shared_ptr<const StageView> before;
+        uint64_t indexTime = 0;
+        string fromTree;
+        if (from.empty()) {
+            StageEntry stageStat;
+            if (statOf(stagePath, stageStat)) indexTime = stageStat.mtimeNs;
+            before = make_shared<const StageView>(stageOf(stagePath));
+            if (before->empty() && !latestCommit().empty()) before = stageOf(latestCommit());
+        } else {
+            string fromID = findHash(from);
+            if (fromID.empty()) return;
+            if (to.empty()) before = stageOf(fromID);
+            else fromTree = treeOf(fromID);
+        }
+        shared_ptr<const StageView> after;
+        string toTree;
+        if (!to.empty()) {
+            string toID = findHash(to);
+            if (toID.empty()) return;
+            if (from.empty()) after = stageOf(toID);
+            else toTree = treeOf(toID);
         }
 
-        stageMap[relativePath] = blobFile;
+        path workTree = repoPath.parent_path();
+        auto show = [&](string_view file, const string& oldHash, const string& newHash, const string* newContent) {
+            string oldContent = oldHash.empty() ? "" : loadObject(oldHash);
+            string loaded = newContent || newHash.empty() ? "" : loadObject(newHash);
+            const string& content = newContent ? *newContent : loaded;
+            cout << "diff a/" << file << " b/" << file << "\n";
+            if (memchr(oldContent.data(), '\0', min<size_t>(oldContent.size(), 8000))
+                || memchr(content.data(), '\0', min<size_t>(content.size(), 8000))) {
+                cout << "Binary files differ\n";
+                return;
+            }
+            cout << "--- " << (oldHash.empty() ? "/dev/null" : "a/" + string(file)) << "\n"
+                 << "+++ " << (newHash.empty() && !newContent ? "/dev/null" : "b/" + string(file)) << "\n"
+                 << unifiedDiff(oldContent, content);
+        };
 
-        ofstream stageOutput(stagePath, ios::trunc);
-        for (const auto& [file, hash] : stageMap) {
-            stageOutput << file << " " << hash << "\n";
+        if (!from.empty() && !to.empty()) {
+            if (fromTree.empty() || toTree.empty()) return;
+            diffTrees(rawOf(fromTree), rawOf(toTree), "", [&](const string& file, string_view was, string_view now) {
+                show(file, was.empty() ? "" : hexOf(was), now.empty() ? "" : hexOf(now), nullptr);
+            });
+            return;
+        }
+        if (!after) {
+            for (size_t i = 0; i < before->size(); ++i) {
+                auto entry = (*before)[i];
+                path fullPath = workTree / entry.path;
+                StageEntry current;
+                string oldHash = hexOf(entry.hash);
+                if (!statOf(fullPath, current)) {
+                    if (sparsePatterns().matches(entry.path)) show(entry.path, oldHash, "", nullptr);
+                    continue;
+                }
+                if (statClean(before->statAt(i), current, indexTime)) continue;
+                ifstream in(fullPath, ios::binary);
+                string content((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+                if (hashOf(content) != oldHash) show(entry.path, oldHash, "", &content);
+            }
+            return;
         }
-        stageOutput.close();
 
-        if (alreadyStaged)
-            cout << "File is restaged with new content - " << relativePath << "\n";
-        else
-            cout << "File is staged - " << relativePath << "\n";
+        joinStages({ before.get(), after.get() }, [&](string_view file, const vector<size_t>& at) {
+            bool was = at[0] < before->size(), now = at[1] < after->size();
+            if (was && now && (*before)[at[0]].hash == (*after)[at[1]].hash) return;
+            show(file, was ? hexOf((*before)[at[0]].hash) : "", now ? hexOf((*after)[at[1]].hash) : "", nullptr);
+        });
     }
 
 /**
- * commit - creates a new commit using the staged files
- * @comment: commit message to describe the changes
+ * fastImport - writes blobs, commits and branches from a stream in one batch
+ * @in: the import stream
+ *
+ * Records, one per line (marks are ":<name>"):
+ *   blob <mark> <size>         followed by <size> bytes and a newline
+ *   commit <branch> [<mark>]   followed by these lines and a blank line:
+ *     author <name>, time <text>, message <size> (then the bytes and a newline),
+ *     from <ref>, merge <ref>, M <blob> <path>, D <path>, deleteall
+ *   reset <branch> <ref>
+ * A <ref> is a mark, a branch or a commit hash. Commits build on the branch
+ * tip unless "from" says otherwise. Trees are kept in memory per branch, so no
+ * stage is rewritten per commit; refs and the commit graph are written once
+ * at the end. A branch whose stage holds uncommitted changes is left where
+ * it was, and so is the checked-out branch if moving it would overwrite
+ * local edits; otherwise the working tree is brought up to it. Existing
+ * stages of moved branches are then rebuilt from their new tips, keeping the
+ * stat data of files that didn't change.
  */
-    void commit(const string& comment) {
-        string branch = activeBranch();
-        path stagePath = repoPath / "stages" / branch;
+    void fastImport(istream& in) {
+        struct ImportBranch {
+            string tip;
+            string start;
+            map<string, string> tree;
+        };
+        unordered_map<string, string> marks;
+        unordered_map<string, ImportBranch> branches;
+        size_t blobs = 0, commits = 0, lineNo = 0;
 
-        if (!exists(stagePath)) {
-            cerr << "Stage file is missing\n";
-            return;
-        }
+        auto fail = [&](const string& what) {
+            cerr << "fast-import: line " << lineNo << ": " << what << "\n";
+        };
+        auto branchOf = [&](const string& name) -> ImportBranch& {
+            auto found = branches.find(name);
+            if (found != branches.end()) return found->second;
+            ImportBranch& branch = branches[name];
+            branch.tip = branch.start = latestCommit(name);
+            if (!branch.tip.empty()) {
+                auto snapshot = stageOf(branch.tip);
+                for (size_t i = 0; i < snapshot->size(); ++i)
+                    branch.tree.emplace(string((*snapshot)[i].path), string((*snapshot)[i].hash));
+            }
+            return branch;
+        };
+        auto resolve = [&](const string& ref) -> string {
+            if (!ref.empty() && ref[0] == ':') {
+                auto found = marks.find(ref);
+                return found == marks.end() ? "" : found->second;
+            }
+            if (branches.count(ref) || exists(repoPath / "refs" / ref)) return branchOf(ref).tip;
+            return hasCommit(ref) ? ref : "";
+        };
+        auto treeOf = [&](const string& commitID) {
+            for (const auto& [name, branch] : branches)
+                if (branch.tip == commitID) return branch.tree;
+            map<string, string> tree;
+            auto snapshot = stageOf(commitID);
+            for (size_t i = 0; i < snapshot->size(); ++i)
+                tree.emplace(string((*snapshot)[i].path), string((*snapshot)[i].hash));
+            return tree;
+        };
+        auto readData = [&](uint64_t size, string& data) {
+            data.resize(size);
+            in.read(data.data(), size);
+            if (uint64_t(in.gcount()) != size) return false;
+            if (in.peek() == '\n') in.get();
+            return true;
+        };
 
-        unordered_map<string, string> staged = stageOf(stagePath);
-        if (staged.empty()) {
-            cerr << "No changes to commit — stage is empty\n";
-            return;
-        }
+        string line;
+        bool pending = false;
+        while (pending || getline(in, line)) {
+            pending = false;
+            ++lineNo;
+            istringstream record(line);
+            string keyword;
+            record >> keyword;
 
-        string snapBlob = blob(stagePath);
-        if (snapBlob.empty()) {
-            cerr << "Unable to snapshot the stage\n";
-            return;
-        }
+            if (keyword.empty()) {
+                continue;
 
-        string lastCommit   = latestCommit();
-        string timestamp    = time();
-        string branchAuthor = Author(branch);
+            } else if (keyword == "blob") {
+                string mark, sizeText, data;
+                uint64_t size;
+                if (!(record >> mark >> sizeText) || !parseNumber(sizeText, size) || !readData(size, data))
+                    return fail("bad blob");
+                string hash = storeObject(data, "blob");
+                if (hash.empty()) return fail("unable to store blob " + mark);
+                marks[mark] = hash;
+                ++blobs;
 
-        CommitNode node;
-        node.stageSnap  = snapBlob;
-        node.prevCommit = lastCommit;
-        node.timestamp  = timestamp;
-        node.author     = branchAuthor;
-        node.comment    = comment;
+            } else if (keyword == "commit") {
+                string name, mark;
+                record >> name >> mark;
+                if (name.empty()) return fail("commit without a branch");
+                ImportBranch& branch = branchOf(name);
 
-        string commit = commitString(node);
-        string commitHash = hashOf(commit);
+                CommitNode node;
+                node.author = Author(name);
+                if (node.author.empty()) node.author = author;
+                string parent = branch.tip, mergeParent;
+                while (getline(in, line)) {
+                    ++lineNo;
+                    istringstream field(line);
+                    string key;
+                    field >> key;
+                    if (key.empty()) break;
+                    string rest;
+                    getline(field, rest);
+                    if (!rest.empty() && rest[0] == ' ') rest.erase(0, 1);
 
-        ofstream(repoPath / "commits" / commitHash) << commit;
-        ofstream(repoPath / "refs" / branch)        << commitHash;
-        ofstream(repoPath / "stages" / branch, ios::trunc).close();
+                    if (key == "author") {
+                        node.author = rest;
+                    } else if (key == "time") {
+                        node.timestamp = rest;
+                    } else if (key == "message") {
+                        uint64_t size;
+                        if (!parseNumber(rest, size) || !readData(size, node.comment)) return fail("bad message");
+                    } else if (key == "from") {
+                        parent = resolve(rest);
+                        if (parent.empty()) return fail("unknown ref " + rest);
+                        if (parent != branch.tip) branch.tree = treeOf(parent);
+                    } else if (key == "merge") {
+                        mergeParent = resolve(rest);
+                        if (mergeParent.empty()) return fail("unknown ref " + rest);
+                    } else if (key == "M") {
+                        string blobRef, file;
+                        istringstream change(rest);
+                        change >> blobRef;
+                        getline(change, file);
+                        if (!file.empty() && file[0] == ' ') file.erase(0, 1);
+                        if (blobRef.empty() || file.empty()) return fail("bad file change");
+                        string hash = blobRef;
+                        if (blobRef[0] == ':') {
+                            auto found = marks.find(blobRef);
+                            hash = found == marks.end() ? "" : found->second;
+                        }
+                        if (hash.size() != hashSize() * 2) return fail("bad file change");
+                        branch.tree[file] = rawOf(hash);
+                    } else if (key == "D") {
+                        branch.tree.erase(rest);
+                    } else if (key == "deleteall") {
+                        branch.tree.clear();
+                    } else {
+                        pending = true;
+                        break;
+                    }
+                }
 
-        cout << "commit @" << commitHash << " - " << comment << "\n";
-    }
+                node.stageSnap  = writeTree(vector<pair<string_view, string_view>>(branch.tree.begin(), branch.tree.end()));
+                if (node.stageSnap.empty()) return fail("unable to store the tree");
+                node.prevCommit = mergeParent.empty() ? parent : parent + "," + mergeParent;
+                if (node.timestamp.empty()) node.timestamp = time();
 
-/**
- * log - displays the commit chain history for the current branch
- */
-    void log() {
-        string id = latestCommit();
-        if (id == "NONE") {
-            cout << "There are no commits yet on this branch.\n";
-            return;
-        }
+                string text = commitString(node);
+                string commitID = hashOf(text);
+                if (!writeFile(repoPath / "commits" / commitID, text))
+                    return fail("unable to write commit " + commitID);
+                branch.tip = commitID;
+                if (!mark.empty()) marks[mark] = commitID;
+                ++commits;
 
-        cout << "\n=========== LOG HISTORY ===========\n\n";
-        while (!id.empty() && id != "NONE") {
-            CommitNode node = CommitData(id);
+            } else if (keyword == "reset") {
+                string name, ref;
+                record >> name >> ref;
+                string target = resolve(ref);
+                if (name.empty() || target.empty()) return fail("bad reset");
+                ImportBranch& branch = branchOf(name);
+                branch.tree = treeOf(target);
+                branch.tip = target;
 
-            if (node.id.empty()) {
-                cerr << "Invalid or unreadable commit: " << id << "\n";
-                break;
+            } else {
+                return fail("unknown record " + keyword);
             }
+        }
 
-            cout << "<" << node.author << "> @ " << node.id << " - \"" << node.comment << "\"\n";
-            cout << node.timestamp << "\n";
+        string active = activeBranch(), activeTip = latestCommit(active);
+        vector<string> moved;
+        vector<pair<string, string>> changes;
+        size_t imported = 0;
+        for (const auto& [name, branch] : branches) {
+            if (!exists(repoPath / "authors" / name)) recordAuthor(name, author);
+            vector<string> staged = branch.tip == branch.start ? vector<string>() : stagedChanges(name);
+            if (!staged.empty()) {
+                cerr << "fast-import: " << name << " has staged changes, commit them first:\n";
+                for (const string& file : staged)
+                    cerr << "    " << file << "\n";
+                continue;
+            }
+            if (name == active && branch.tip != branch.start
+                && (!recoverChanges(branch.tip, activeTip, changes) || clobbersLocalEdits(changes, "fast-import"))) {
+                cerr << "fast-import: " << name << " was left at " << (activeTip.empty() ? "no commit" : activeTip) << "\n";
+                continue;
+            }
+            if (!writeRef(repoPath / "refs" / name, branch.tip, &branch.start)) continue;
+            if (!branch.tip.empty()) graphPosition(branch.tip);
+            if (branch.tip != branch.start) moved.push_back(name);
+            ++imported;
+        }
 
-            if (node.prevCommit.empty()) {
-                cout << "Previous commit: NONE\n";
-                break;
+        cout << blobs << " blobs, " << commits << " commits, " << imported << " branches imported\n";
+        for (const string& name : moved) {
+            if (name == active) {
+                applyChanges(changes);
+                cout << "Files are restored successfully from commit - " << branches[name].tip << "\n";
             }
+            if (!exists(repoPath / "stages" / name)) continue;
+            LockFile stageLock(repoPath / "stages" / name);
+            if (!stageLock) {
+                cerr << "The stage of " << name << " is locked by another process\n";
+                continue;
+            }
+            const auto& tree = branches[name].tree;
+            writeIndex(stageLock, name, vector<pair<string_view, string_view>>(tree.begin(), tree.end()));
+        }
+        syncWrites();
+    }
+};
 
-            int commaIdx = node.prevCommit.find(',');
-            string prevCommitID = (commaIdx != string::npos) ? node.prevCommit.substr(0, commaIdx) : node.prevCommit;
 
-            cout << "Previous commit: " << prevCommitID << "\n";
-            cout << "----------------------------------------\n";
-            id = prevCommitID;
-        }
+/**
+ * ErrorCounter - forwards a stream buffer and counts what passes through it
+ */
+class ErrorCounter : public streambuf {
+    streambuf* target;
+
+protected:
+    int overflow(int c) override {
+        ++count;
+        return c == EOF ? 0 : target->sputc(c);
+    }
+    streamsize xsputn(const char* s, streamsize n) override {
+        count += n;
+        return target->sputn(s, n);
     }
+    int sync() override { return target->pubsync(); }
+
+public:
+    size_t count = 0;
+    explicit ErrorCounter(streambuf* target) : target(target) {}
+};
 
 /**
- * branch - Creates a new branch pointing to the current commit
- * @name: new branch name
- * @Author: author of the new branch
+ * run - executes one command for the REPL or the command line
+ * @git: the repository
+ * @args: the command followed by its arguments
+ * Return: exit status, 1 if the command reported anything on cerr
  */
-    void branch(const string& name, const string& Author) {
-        path branchPath = repoPath / "refs" / name;
-        if (exists(branchPath)) {
-            cout << "It already exists - Branch" << name << "\n";
-            return;
+int run(MinGit& git, const vector<string>& args) {
+    ErrorCounter errors(cerr.rdbuf());
+    streambuf* previous = cerr.rdbuf(&errors);
+    string keyword = args.empty() ? "" : args[0];
+    TraceSpan span(Tracer::enabled ? Tracer::intern("run " + keyword) : "");
+
+    if (keyword == "help") {
+        cout << "Commands:\n"
+             << "  init [--hash=sha1|sha256|blake3]\n"
+             << "  add <file|dir|glob>... | add -A\n"
+             << "  commit [-m] <message>\n"
+             << "  log [-- <path>]\n"
+             << "  branch <name> <author>\n"
+             << "  checkout <target>\n"
+             << "  merge <branch> | merge --abort\n"
+             << "  status\n"
+             << "  sparse-checkout set <pattern>... | list | disable\n"
+             << "  diff [<from> [<to>]]\n"
+             << "  gc [--prune] [--grace=<seconds>]\n"
+             << "  prune [--grace=<seconds>]\n"
+             << "  fsck\n"
+             << "  fast-import [file]\n"
+             << "  exit\n";
+
+    } else if (keyword == "init") {
+        string hash = "sha1";
+        for (size_t i = 1; i < args.size(); ++i) {
+            if (args[i].rfind("--hash=", 0) == 0) hash = args[i].substr(7);
+            else if (args[i] == "--hash" && i + 1 < args.size()) hash = args[++i];
         }
+        git.init(hash);
 
-        string commitHash = latestCommit();
+    } else if (!keyword.empty() && !git.hashSupported()) {
+        // every other command reads or writes objects
 
-        ofstream branchRef(branchPath);
-        branchRef << commitHash;
-        branchRef.close();
+    } else if (keyword == "add") {
+        vector<string> files(args.begin() + 1, args.end());
+        if (files.empty())
+            cout << "Please input the file path.\n";
+        else
+            git.add(files);
 
-        recordAuthor(name, Author);
+    } else if (keyword == "commit") {
+        size_t first = args.size() > 1 && args[1] == "-m" ? 2 : 1;
+        string message;
+        for (size_t i = first; i < args.size(); ++i)
+            message += (i > first ? " " : "") + args[i];
+        git.commit(message);
 
-        cout << "Branch @" << name << " successfully created at commit " << commitHash << "\n";
-    }
+    } else if (keyword == "log") {
+        if (args.size() > 2 && args[1] == "--")
+            git.log(args[2]);
+        else
+            git.log(args.size() > 1 && args[1] != "--" ? args[1] : "");
 
-/**
- * checkout - switches to a given commit or branch
- * @targetHash: branch name or commit ID 
- */
-        void checkout(const string& targetHash) {
-            string resolvedHash = findHash(targetHash);
-            if (resolvedHash.empty()) return;
-    
-            ofstream hStream(repoPath / "HEAD", ios::trunc);
-            hStream << targetHash;
-            hStream.close();
-    
-            if (exists(repoPath / "refs" / targetHash)) {
-                cout << "Branch switched to " << targetHash << "\n";
+    } else if (keyword == "branch") {
+        if (args.size() < 3)
+            cout << "Please input the branch name and author.\n";
+        else
+            git.branch(args[1], args[2]);
+
+    } else if (keyword == "checkout") {
+        if (args.size() < 2)
+            cout << "Please input the target (branch or commit hash).\n";
+        else
+            git.checkout(args[1]);
+
+    } else if (keyword == "gc" || keyword == "prune") {
+        bool pruning = keyword == "prune", valid = true, graceGiven = false;
+        uint64_t grace = 0;
+        for (size_t i = 1; i < args.size(); ++i) {
+            if (args[i] == "--prune") {
+                pruning = true;
+            } else if (args[i].rfind("--grace=", 0) == 0 && parseNumber(args[i].substr(8), grace)) {
+                graceGiven = true;
             } else {
-                cout << "went to commit @" << targetHash << "\n";
+                cerr << "Invalid option " << args[i] << "\nUsage: " << keyword
+                     << (keyword == "gc" ? " [--prune]" : "") << " [--grace=<seconds>]\n";
+                valid = false;
             }
-    
-            recover(resolvedHash);
+        }
+        if (!valid || (!graceGiven && !git.pruneGrace(grace))) {
+            // the error is already reported
+        } else if (keyword == "prune") {
+            git.prune(grace);
+        } else {
+            git.gc(pruning, grace);
         }
 
+    } else if (keyword == "fsck") {
+        git.fsck();
+
+    } else if (keyword == "status") {
+        git.status();
+
+    } else if (keyword == "diff") {
+        git.diff(args.size() > 1 ? args[1] : "", args.size() > 2 ? args[2] : "");
+
+    } else if (keyword == "merge") {
+        if (args.size() < 2)
+            cout << "Please input the branch to merge.\n";
+        else if (args[1] == "--abort")
+            git.abortMerge();
+        else
+            git.merge(args[1]);
+
+    } else if (keyword == "sparse-checkout") {
+        string action = args.size() > 1 ? args[1] : "list";
+        if (action == "set" && args.size() > 2) {
+            git.sparseCheckout(vector<string>(args.begin() + 2, args.end()));
+        } else if (action == "disable") {
+            git.sparseCheckout({});
+        } else if (action == "list") {
+            git.listSparse();
+        } else {
+            cout << "Usage: sparse-checkout set <pattern>... | list | disable\n";
+        }
+
+    } else if (keyword == "fast-import") {
+        if (args.size() < 2) {
+            git.fastImport(cin);
+        } else {
+            ifstream stream(args[1], ios::binary);
+            if (stream)
+                git.fastImport(stream);
+            else
+                cerr << "Unable to open " << args[1] << "\n";
+        }
+
+    } else {
+        cerr << "Unknown command.\n";
+    }
+
+    git.syncWrites();
+    cout.flush();
+    cerr.rdbuf(previous);
+    return errors.count > 0 ? 1 : 0;
+}
 
 /**
- * merge - merges another branch into the current branch
- * @branch: name of the branch to merge into the current branch
+ * main - runs one command from argv, or the interactive prompt without one
+ *
+ * Usage: minigit [-C <dir>] [--author <name>] [-q] [--trace=<file>] [--stats] <command> [args...]
+ * MINIGIT_TRACE and MINIGIT_STATS enable tracing for the interactive prompt too.
  */
+int main(int argc, char* argv[]) {
+    if (const char* trace = getenv("MINIGIT_TRACE")) Tracer::tracePath = trace;
+    if (const char* stats = getenv("MINIGIT_STATS")) Tracer::stats = string(stats) != "0";
 
-    void merge(const string& branch) {  
-        string currentBranch = activeBranch();  
-  
-        if (branch == currentBranch) {  
-            cerr << "You can't merge a branch onto itself\n";  
-            return;  
-        }  
-  
-        path branchPath = repoPath / "refs" / branch;  
-        if (!exists(branchPath)) {  
-            cerr << "Branch " << branch << " doesn't exist\n";  
-            return;  
-        }  
-  
-        string currentCommit = latestCommit();  
-        string branchCommit  = latestCommit(branch);  
-        string ancestorCommit = commonAncestor(currentCommit, branchCommit);  
-  
-        if (ancestorCommit.empty()) {  
-            cerr << branch << " and " << currentBranch << " have no common ancestor\n";  
-            return;  
-        }  
-  
-        auto ancestorMap = stageOf(ancestorCommit);  
-        auto currentMap  = stageOf(currentCommit);  
-        auto branchMap   = stageOf(branchCommit);  
-  
-        unordered_set<string> fileCollection;  
-        for (const auto* fileMap : { &ancestorMap, &currentMap, &branchMap })  
-            for (const auto& [fileName, _] : *fileMap)  
-                fileCollection.insert(fileName);  
-  
-        unordered_map<string, string> mergedStage;  
-        vector<string> conflictList;  
-  
-        for (const string& fileName : fileCollection) {  
-            string resolved = manageConflict(ancestorMap[fileName], currentMap[fileName], branchMap[fileName]);  
-            if (resolved.empty())  
-                conflictList.push_back(fileName);  
-            else  
-                mergedStage[fileName] = resolved;  
-        }  
-  
-        if (!conflictList.empty()) {  
-            cerr << "Conflict occurred in merge - ";  
-            for (size_t i = 0; i < conflictList.size(); ++i) {  
-                cerr << conflictList[i];  
-                if (i < conflictList.size() - 1) cerr << ", ";  
-            }  
-            cerr << "\n";  
-        }  
-  
-        string stagePath = mergeStage(mergedStage);  
-        string stageBlob = blob(stagePath);  
-        remove(stagePath);  
-  
-        CommitNode node;  
-        node.stageSnap  = stageBlob;  
-        node.prevCommit = currentCommit;  
-        node.timestamp  = time();  
-        node.author     = Author(currentBranch);  
-        node.comment    = "Merged from " + branch;  
-  
-        string commitText = commitString(node);  
-        string commitID   = hashOf(commitText);  
-  
-        ofstream(repoPath / "commits" / commitID) << commitText;  
-        ofstream(repoPath / "refs" / currentBranch) << commitID;  
-  
-        cout << "Merge Commit @" << commitID << " - " << node.comment << "\n";  
-}
-};
+    if (argc > 1) {
+        string repoPath = current_path().string(), author;
+        if (const char* env = getenv("MINIGIT_AUTHOR")) author = env;
+        else if (const char* user = getenv("USER")) author = user;
+        else author = "unknown";
+
+        bool quiet = false;
+        int i = 1;
+        for (; i < argc && argv[i][0] == '-'; ++i) {
+            string option = argv[i];
+            if (option == "-C" && i + 1 < argc) {
+                repoPath = argv[++i];
+            } else if (option == "--author" && i + 1 < argc) {
+                author = argv[++i];
+            } else if (option == "-q") {
+                quiet = true;
+            } else if (option.rfind("--trace=", 0) == 0) {
+                Tracer::tracePath = option.substr(8);
+            } else if (option == "--trace" && i + 1 < argc) {
+                Tracer::tracePath = argv[++i];
+            } else if (option == "--stats") {
+                Tracer::stats = true;
+            } else {
+                cerr << "Unknown option " << option << "\n";
+                return 2;
+            }
+        }
+        if (i == argc) {
+            cerr << "Usage: minigit [-C <dir>] [--author <name>] [-q] [--trace=<file>] [--stats] <command> [args...]\n";
+            return 2;
+        }
 
+        ios::sync_with_stdio(false);
+        if (quiet) cout.rdbuf(nullptr);
+        Tracer::enabled = Tracer::stats || !Tracer::tracePath.empty();
+        MinGit git(absolute(repoPath).lexically_normal().string(), author);
+        int status = run(git, vector<string>(argv + i, argv + argc));
+        Tracer::finish();
+        return status;
+    }
 
-int main() {
+    Tracer::enabled = Tracer::stats || !Tracer::tracePath.empty();
     string repoPath, author;
 
     cout << "===========================\n";
@@ -662,78 +5868,28 @@ int main() {
     string input;
     while (true) {
         cout << "miniGIT<" << directoryName << ">$ ";
-        getline(cin, input);
+        if (!getline(cin, input)) break;
         istringstream stream(input);
-        string keyword;
-        stream >> keyword;
-
-        if (keyword == "exit") {
-            break;
-
-        } else if (keyword == "help") {
-            cout << "Commands:\n"
-                 << "  init\n"
-                 << "  add <file>\n"
-                 << "  commit <message>\n"
-                 << "  log\n"
-                 << "  branch <name> <author>\n"
-                 << "  checkout <target>\n"
-                 << "  merge <branch>\n"
-                 << "  exit\n";
-
-        } else if (keyword == "init") {
-            git.init();
-
-        } else if (keyword == "add") {
-            string file;
-            stream >> file;
-            if (file.empty())
-                cout << "Please input the file path.\n";
-            else
-                git.add(file);
-
-        } else if (keyword == "commit") {
+        vector<string> args;
+        string word;
+        while (stream >> word) args.push_back(word);
+        if (args.size() > 1 && args[0] == "commit") {
+            // the message is the rest of the line, spacing included
+            istringstream rest(input);
+            rest >> word;
+            if (args[1] == "-m") rest >> word;
             string message;
-            getline(stream, message);
-            if (!message.empty() && message[0] == ' ') message.erase(0, 1);
-            git.commit(message);
-
-        } else if (keyword == "log") {
-            git.log();
-
-        } else if (keyword == "branch") {
-            string name, branchAuthor;
-            stream >> name >> branchAuthor;
-            if (name.empty() || branchAuthor.empty())
-                cout << "Please input the branch name and author.\n";
-            else
-                git.branch(name, branchAuthor);
-
-        } else if (keyword == "checkout") {
-            string target;
-            stream >> target;
-            if (target.empty())
-                cout << "Please input the target (branch or commit hash).\n";
-            else
-                git.checkout(target);
-
-        } else if (keyword == "merge") {
-            string branch;
-            stream >> branch;
-            if (branch.empty())
-                cout << "Please input the branch to merge.\n";
-            else
-                git.merge(branch);
-
-        } else {
-            cout << "Unknown command.\n";
+            getline(rest >> ws, message);
+            args = { "commit", "-m", message };
         }
 
+        if (!args.empty() && args[0] == "exit") break;
+        if (!args.empty()) run(git, args);
+
         cout << "\n";
     }
 
     cout << "Terminated.\n";
+    Tracer::finish();
     return 0;
 }
-
-
@@ -0,0 +1,471 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <map>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <numeric>
+#include <functional>
+#include <filesystem>
+#include <cstring>
+#include <cerrno>
+#include <cmath>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+
+using namespace std;
+using namespace filesystem;
+
+/**
+ * BenchConfig - shape of the synthetic repository and how to measure it
+ */
+struct BenchConfig {
+    string binary = "./minigit";
+    path work = temp_directory_path() / "minigit-bench";
+    size_t files = 1000;
+    size_t minSize = 256, maxSize = 64 << 10;
+    size_t depth = 20;
+    size_t branches = 4;
+    double editRatio = 0.05;
+    size_t runs = 1;
+    unsigned seed = 1;
+    vector<string> caches = { "warm", "cold" };
+    string out, baseline;
+    double threshold = 10;
+};
+
+/**
+ * Sample - cost of one command run
+ */
+struct Sample {
+    double wallMs = 0, userMs = 0, sysMs = 0;
+    long maxRssKb = 0;
+    uint64_t syscr = 0, syscw = 0, readBytes = 0, writeBytes = 0;
+    bool measured = false;
+};
+
+/**
+ * ioCounters - reads the I/O accounting of a finished, not yet reaped process
+ * @pid: the process id
+ * Return: map of /proc/<pid>/io fields, empty if unavailable
+ */
+map<string, uint64_t> ioCounters(pid_t pid) {
+    map<string, uint64_t> counters;
+    ifstream in("/proc/" + to_string(pid) + "/io");
+    string key;
+    uint64_t value;
+    while (in >> key >> value) {
+        key.pop_back();
+        counters[key] = value;
+    }
+    return counters;
+}
+
+/**
+ * runCommand - runs the minigit binary once and measures it
+ * @config: benchmark configuration
+ * @repo: working tree passed with -C
+ * @args: command and arguments
+ * @sample: set to the measured cost, left unmeasured if the command couldn't start
+ * Return: true if the command exited with status 0
+ *
+ * The child is waited for with WNOWAIT first, so /proc/<pid>/io can still be
+ * read before it is reaped; wait4 then reports its rusage.
+ */
+bool runCommand(const BenchConfig& config, const path& repo, const vector<string>& args, Sample& sample) {
+    vector<string> argv = { config.binary, "-q", "-C", repo.string() };
+    argv.insert(argv.end(), args.begin(), args.end());
+    vector<char*> cargv;
+    for (auto& arg : argv) cargv.push_back(arg.data());
+    cargv.push_back(nullptr);
+
+    auto start = chrono::steady_clock::now();
+    pid_t pid = fork();
+    if (pid < 0) {
+        cerr << "Unable to fork: " << strerror(errno) << "\n";
+        return false;
+    }
+    if (pid == 0) {
+        int null = open("/dev/null", O_RDWR);
+        dup2(null, STDIN_FILENO);
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        setenv("MINIGIT_AUTHOR", "bench", 1);
+        execv(cargv[0], cargv.data());
+        _exit(127);
+    }
+
+    siginfo_t info;
+    waitid(P_PID, pid, &info, WEXITED | WNOWAIT);
+    auto end = chrono::steady_clock::now();
+    auto io = ioCounters(pid);
+
+    int status;
+    struct rusage usage;
+    wait4(pid, &status, 0, &usage);
+
+    sample.wallMs = chrono::duration<double, milli>(end - start).count();
+    sample.userMs = usage.ru_utime.tv_sec * 1e3 + usage.ru_utime.tv_usec / 1e3;
+    sample.sysMs = usage.ru_stime.tv_sec * 1e3 + usage.ru_stime.tv_usec / 1e3;
+    sample.maxRssKb = usage.ru_maxrss;
+    sample.syscr = io["syscr"];
+    sample.syscw = io["syscw"];
+    sample.readBytes = io["read_bytes"];
+    sample.writeBytes = io["write_bytes"];
+    sample.measured = true;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/**
+ * evictCache - drops a directory tree from the page cache
+ * @dir: directory to evict
+ *
+ * Files are synced and then advised away one by one, which needs no
+ * privileges, unlike writing to /proc/sys/vm/drop_caches.
+ */
+void evictCache(const path& dir) {
+    error_code ec;
+    for (auto it = recursive_directory_iterator(dir, ec); it != recursive_directory_iterator(); it.increment(ec)) {
+        if (ec) break;
+        if (!it->is_regular_file(ec)) continue;
+        int fd = open(it->path().c_str(), O_RDONLY);
+        if (fd < 0) continue;
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+/**
+ * Generator - writes and edits the files of the synthetic working tree
+ *
+ * Sizes are drawn log-uniformly between minSize and maxSize, which gives the
+ * many-small, few-large mix of real trees. Files are spread over two levels
+ * of directories.
+ */
+class Generator {
+    const BenchConfig& config;
+    mt19937_64 rng;
+    vector<string> names;
+
+    string content(size_t size) {
+        static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz0123456789 \n";
+        string data(size, ' ');
+        uniform_int_distribution<int> pick(0, sizeof(alphabet) - 2);
+        for (auto& c : data) c = alphabet[pick(rng)];
+        return data;
+    }
+
+    size_t size() {
+        uniform_real_distribution<double> exponent(log(double(config.minSize)), log(double(config.maxSize)));
+        return size_t(exp(exponent(rng)));
+    }
+
+public:
+    Generator(const BenchConfig& config) : config(config), rng(config.seed) {
+        for (size_t i = 0; i < config.files; ++i)
+            names.push_back("d" + to_string(i % 16) + "/s" + to_string(i % 97) + "/f" + to_string(i) + ".txt");
+    }
+
+    void populate(const path& tree) {
+        for (const auto& name : names) {
+            create_directories((tree / name).parent_path());
+            ofstream(tree / name, ios::binary) << content(size());
+        }
+    }
+
+/**
+ * edit - rewrites a random editRatio share of the files
+ * @tree: the working tree
+ * @slice: which of @slices disjoint file sets to edit
+ * @slices: number of file sets, so edits on different branches never conflict
+ * Return: number of files changed
+ */
+    size_t edit(const path& tree, size_t slice = 0, size_t slices = 1) {
+        size_t owned = slice < names.size() ? (names.size() - slice + slices - 1) / slices : 0;
+        if (owned == 0) return 0;
+        size_t count = max<size_t>(1, size_t(owned * config.editRatio));
+        uniform_int_distribution<size_t> pick(0, owned - 1);
+        for (size_t i = 0; i < count; ++i) {
+            const string& name = names[pick(rng) * slices + slice];
+            ofstream(tree / name, ios::binary | ios::app) << content(64);
+        }
+        return count;
+    }
+};
+
+/**
+ * scenario - builds a repository through every command, timing each call
+ * @config: benchmark configuration
+ * @cold: evict the repository from the page cache before every command
+ * @samples: receives the samples per command
+ * Return: false if a command failed
+ */
+bool scenario(const BenchConfig& config, bool cold, map<string, vector<Sample>>& samples) {
+    path tree = config.work / (cold ? "cold" : "warm");
+    remove_all(tree);
+    create_directories(tree);
+    Generator generator(config);
+    generator.populate(tree);
+
+    bool ok = true;
+    auto timed = [&](const string& name, const vector<string>& args) {
+        if (cold) evictCache(tree);
+        Sample sample;
+        if (!runCommand(config, tree, args, sample)) {
+            ok = false;
+            cerr << "command failed: " << name << "\n";
+        }
+        if (sample.measured) samples[name].push_back(sample);
+    };
+
+    timed("init", { "init" });
+    timed("add", { "add", "-A" });
+    timed("commit", { "commit", "-m", "base" });
+    for (size_t i = 0; i < config.depth; ++i) {
+        generator.edit(tree);
+        timed("add", { "add", "-A" });
+        timed("commit", { "commit", "-m", "edit " + to_string(i) });
+    }
+    timed("log", { "log" });
+
+    for (size_t b = 0; b < config.branches; ++b) {
+        string name = "b" + to_string(b);
+        timed("branch", { "branch", name, "bench" });
+        timed("checkout", { "checkout", name });
+        generator.edit(tree, b, config.branches);
+        timed("add", { "add", "-A" });
+        timed("commit", { "commit", "-m", "work on " + name });
+        timed("checkout", { "checkout", "master" });
+    }
+    for (size_t b = 0; b < config.branches; ++b)
+        timed("merge", { "merge", "b" + to_string(b) });
+    timed("log", { "log" });
+    timed("log path", { "log", "--", "d0/s0/f0.txt" });
+    return ok;
+}
+
+/**
+ * percentile - nearest-rank percentile of a sorted list
+ */
+double percentile(const vector<double>& sorted, double p) {
+    if (sorted.empty()) return 0;
+    size_t rank = size_t(ceil(p / 100 * sorted.size()));
+    return sorted[min(sorted.size(), max<size_t>(rank, 1)) - 1];
+}
+
+/**
+ * summarize - reduces the samples of one command to report fields
+ * @samples: samples of the command
+ * Return: field name to value, in report order
+ */
+vector<pair<string, double>> summarize(const vector<Sample>& samples) {
+    vector<double> wall;
+    double user = 0, sys = 0, syscr = 0, syscw = 0, readBytes = 0, writeBytes = 0;
+    long rss = 0;
+    for (const auto& sample : samples) {
+        wall.push_back(sample.wallMs);
+        user += sample.userMs;
+        sys += sample.sysMs;
+        rss = max(rss, sample.maxRssKb);
+        syscr += sample.syscr;
+        syscw += sample.syscw;
+        readBytes += sample.readBytes;
+        writeBytes += sample.writeBytes;
+    }
+    sort(wall.begin(), wall.end());
+    double n = samples.size(), mean = accumulate(wall.begin(), wall.end(), 0.0) / n;
+    return {
+        { "samples", n },
+        { "ops_per_s", mean > 0 ? 1000 / mean : 0 },
+        { "mean_ms", mean },
+        { "p50_ms", percentile(wall, 50) },
+        { "p90_ms", percentile(wall, 90) },
+        { "p99_ms", percentile(wall, 99) },
+        { "max_ms", wall.back() },
+        { "user_ms", user / n },
+        { "sys_ms", sys / n },
+        { "peak_rss_kb", double(rss) },
+        { "read_syscalls", syscr / n },
+        { "write_syscalls", syscw / n },
+        { "read_bytes", readBytes / n },
+        { "write_bytes", writeBytes / n },
+    };
+}
+
+/**
+ * flattenJson - reads the numbers of a JSON document under dotted key paths
+ * @text: JSON text
+ * @values: receives "a.b.c" -> number for every numeric leaf
+ * Return: false if the text is not valid JSON
+ */
+bool flattenJson(const string& text, map<string, double>& values) {
+    size_t pos = 0;
+    auto skip = [&]() { while (pos < text.size() && isspace(uint8_t(text[pos]))) ++pos; };
+    auto readString = [&](string& out) {
+        if (text[pos] != '"') return false;
+        for (++pos; pos < text.size() && text[pos] != '"'; ++pos) {
+            if (text[pos] == '\\') ++pos;
+            out += text[pos];
+        }
+        return pos++ < text.size();
+    };
+    function<bool(const string&)> value = [&](const string& key) {
+        skip();
+        if (pos >= text.size()) return false;
+        char c = text[pos];
+        if (c == '{' || c == '[') {
+            char close = c == '{' ? '}' : ']';
+            ++pos;
+            for (size_t index = 0;; ++index) {
+                skip();
+                if (pos < text.size() && text[pos] == close) return ++pos, true;
+                string name = to_string(index);
+                if (c == '{') {
+                    name.clear();
+                    if (!readString(name)) return false;
+                    skip();
+                    if (pos >= text.size() || text[pos++] != ':') return false;
+                }
+                if (!value(key.empty() ? name : key + "." + name)) return false;
+                skip();
+                if (pos < text.size() && text[pos] == ',') ++pos;
+            }
+        }
+        if (c == '"') {
+            string ignored;
+            return readString(ignored);
+        }
+        size_t end = text.find_first_of(",}] \n\r\t", pos);
+        string token = text.substr(pos, end - pos);
+        pos = end == string::npos ? text.size() : end;
+        if (token == "true" || token == "false" || token == "null") return true;
+        char* parsed;
+        double number = strtod(token.c_str(), &parsed);
+        if (*parsed) return false;
+        values[key] = number;
+        return true;
+    };
+    return value("");
+}
+
+/**
+ * usage - prints the command line options
+ */
+void usage() {
+    cerr << "Usage: minigitBench [options]\n"
+         << "  --binary <path>       minigit executable (./minigit)\n"
+         << "  --work <dir>          scratch directory\n"
+         << "  --files <n>           files in the tree (1000)\n"
+         << "  --min-size <bytes>    smallest file (256)\n"
+         << "  --max-size <bytes>    largest file (65536)\n"
+         << "  --depth <n>           commits of history (20)\n"
+         << "  --branches <n>        branches created and merged (4)\n"
+         << "  --edit-ratio <r>      share of files edited per commit (0.05)\n"
+         << "  --runs <n>            repetitions of the whole scenario (1)\n"
+         << "  --seed <n>            generator seed (1)\n"
+         << "  --cache warm|cold|both page cache state per command (both)\n"
+         << "  --out <file>          write the JSON report here instead of stdout\n"
+         << "  --baseline <file>     compare p50 latencies against a saved report\n"
+         << "  --threshold <pct>     regression threshold for --baseline (10)\n";
+}
+
+/**
+ * main - generates synthetic repositories, times every command, reports JSON
+ *
+ * The exit status is 1 if a command failed or a p50 latency regressed past
+ * the threshold against the baseline.
+ */
+int main(int argc, char* argv[]) {
+    BenchConfig config;
+    for (int i = 1; i < argc; ++i) {
+        string option = argv[i];
+        if (i + 1 >= argc) {
+            usage();
+            return 2;
+        }
+        string value = argv[++i];
+        if (option == "--binary") config.binary = absolute(value).string();
+        else if (option == "--work") config.work = absolute(value);
+        else if (option == "--files") config.files = stoul(value);
+        else if (option == "--min-size") config.minSize = stoul(value);
+        else if (option == "--max-size") config.maxSize = stoul(value);
+        else if (option == "--depth") config.depth = stoul(value);
+        else if (option == "--branches") config.branches = stoul(value);
+        else if (option == "--edit-ratio") config.editRatio = stod(value);
+        else if (option == "--runs") config.runs = stoul(value);
+        else if (option == "--seed") config.seed = stoul(value);
+        else if (option == "--cache" && value == "both") config.caches = { "warm", "cold" };
+        else if (option == "--cache" && (value == "warm" || value == "cold")) config.caches = { value };
+        else if (option == "--out") config.out = value;
+        else if (option == "--baseline") config.baseline = value;
+        else if (option == "--threshold") config.threshold = stod(value);
+        else {
+            usage();
+            return 2;
+        }
+    }
+    config.binary = absolute(config.binary).string();
+    if (config.files == 0 || config.minSize == 0 || config.maxSize < config.minSize) {
+        usage();
+        return 2;
+    }
+
+    bool ok = true;
+    map<string, map<string, vector<Sample>>> results;
+    for (const string& cache : config.caches)
+        for (size_t run = 0; run < config.runs; ++run)
+            ok = scenario(config, cache == "cold", results[cache]) && ok;
+
+    ostringstream report;
+    report << fixed << setprecision(3);
+    report << "{\n  \"config\": {\"files\": " << config.files << ", \"min_size\": " << config.minSize
+           << ", \"max_size\": " << config.maxSize << ", \"depth\": " << config.depth
+           << ", \"branches\": " << config.branches << ", \"edit_ratio\": " << config.editRatio
+           << ", \"runs\": " << config.runs << ", \"seed\": " << config.seed << "},\n  \"results\": {";
+    for (auto cache = results.begin(); cache != results.end(); ++cache) {
+        report << (cache == results.begin() ? "" : ",") << "\n    \"" << cache->first << "\": {";
+        for (auto command = cache->second.begin(); command != cache->second.end(); ++command) {
+            report << (command == cache->second.begin() ? "" : ",") << "\n      \"" << command->first << "\": {";
+            auto fields = summarize(command->second);
+            for (size_t f = 0; f < fields.size(); ++f)
+                report << (f ? ", " : "") << "\"" << fields[f].first << "\": " << fields[f].second;
+            report << "}";
+        }
+        report << "\n    }";
+    }
+    report << "\n  }\n}\n";
+
+    if (config.out.empty()) cout << report.str();
+    else ofstream(config.out) << report.str();
+
+    if (!config.baseline.empty()) {
+        ifstream in(config.baseline);
+        stringstream saved;
+        saved << in.rdbuf();
+        map<string, double> before, after;
+        if (!in || !flattenJson(saved.str(), before) || !flattenJson(report.str(), after)) {
+            cerr << "Unable to read the baseline " << config.baseline << "\n";
+            return 1;
+        }
+        for (const auto& [key, value] : after) {
+            if (key.size() < 7 || key.compare(key.size() - 7, 7, ".p50_ms") != 0) continue;
+            auto old = before.find(key);
+            if (old == before.end() || old->second <= 0) continue;
+            double change = (value - old->second) / old->second * 100;
+            bool regressed = change > config.threshold;
+            cerr << (regressed ? "REGRESSION " : "           ") << key << ": " << fixed << setprecision(3)
+                 << old->second << " -> " << value << " ms (" << showpos << setprecision(1) << change
+                 << noshowpos << "%)\n";
+            ok = ok && !regressed;
+        }
+    }
+    return ok ? 0 : 1;
+}